@@ -1,4 +1,11 @@
-﻿#define STB_IMAGE_IMPLEMENTATION
+﻿#include <cstddef>
+// stb_image виділяє пам'ять через лічильник, щоб --microbench бачив і ці виділення
+void* countedMalloc(size_t size);
+void* countedRealloc(void* pointer, size_t size);
+#define STBI_MALLOC(size) countedMalloc(size)
+#define STBI_REALLOC(pointer, size) countedRealloc(pointer, size)
+#define STBI_FREE(pointer) free(pointer)
+#define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 #include <iostream>
@@ -9,6 +16,44 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <unordered_map>
+#include <unordered_set>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <atomic>
+#include <new>
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#define EGL_NO_X11 // без Xlib.h: його макроси (None, Status, Bool) ламають решту коду
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -24,16 +69,136 @@ glm::vec3 cameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
 glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
 float yaw = -90.0f; 
 float pitch = 0.0f;  
+// поточний розмір кадру: вікно після зміни розміру або FBO безвіконного режиму
+int framebufferWidth = SCR_WIDTH;
+int framebufferHeight = SCR_HEIGHT;
+GLuint sceneFramebuffer = 0; // 0 - вікно; допоміжні проходи повертаються сюди
 float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
 float fov = 45.0f; 
 
-size_t skyIndexCount;
 GLuint skyTextureID;
+const char* SKY_TEXTURE_PATH = "D:/vscode_asd_laz/test_shaders/pictures/bg.jpeg";
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
+// CPU-профайлер: зона - це пара позначок часу в кільцевому буфері свого потоку, без блокувань.
+// --trace <file.json> вмикає запис, файл у форматі Chrome trace_event пишеться на виході
+// і по F9. З -DSOLAR_CPU_PROFILER=0 макрос CPU_ZONE нічого не генерує.
+#ifndef SOLAR_CPU_PROFILER
+#define SOLAR_CPU_PROFILER 1
+#endif
+
+#if SOLAR_CPU_PROFILER
+const size_t CPU_TRACE_EVENTS = 1 << 16; // на потік; найстаріші події перезаписуються
+
+struct CpuTraceEvent {
+    const char* name; // лише рядкові літерали, тож зберігається вказівник
+    int64_t start;    // нс від запуску профайлера
+    int64_t duration;
+};
+
+struct CpuTraceBuffer {
+    CpuTraceEvent events[CPU_TRACE_EVENTS];
+    std::atomic<uint64_t> count{0};
+    int threadId = 0;
+    bool mainThread = false;
+};
+
+struct CpuProfiler {
+    bool enabled = false;
+    std::string path;
+    std::chrono::steady_clock::time_point origin;
+    std::thread::id mainThread;
+    std::mutex mutex; // реєстрація потоків і запис файлу, не самі зони
+    std::vector<CpuTraceBuffer*> buffers; // не звільняються: потік може писати до самого виходу
+};
+
+CpuProfiler cpuProfiler;
+thread_local CpuTraceBuffer* cpuTraceBuffer = NULL;
+
+void startCpuProfiler(const std::string& path) {
+    cpuProfiler.path = path;
+    cpuProfiler.origin = std::chrono::steady_clock::now();
+    cpuProfiler.mainThread = std::this_thread::get_id();
+    cpuProfiler.enabled = true;
+}
+
+CpuTraceBuffer* registerCpuTraceThread() {
+    CpuTraceBuffer* buffer = new CpuTraceBuffer;
+    std::lock_guard<std::mutex> lock(cpuProfiler.mutex);
+    buffer->threadId = (int)cpuProfiler.buffers.size() + 1;
+    buffer->mainThread = std::this_thread::get_id() == cpuProfiler.mainThread;
+    cpuProfiler.buffers.push_back(buffer);
+    return buffer;
+}
+
+void recordCpuZone(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    if (!cpuTraceBuffer)
+        cpuTraceBuffer = registerCpuTraceThread();
+    uint64_t index = cpuTraceBuffer->count.load(std::memory_order_relaxed);
+    CpuTraceEvent& event = cpuTraceBuffer->events[index % CPU_TRACE_EVENTS];
+    event.name = name;
+    event.start = std::chrono::duration_cast<std::chrono::nanoseconds>(start - cpuProfiler.origin).count();
+    event.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    cpuTraceBuffer->count.store(index + 1, std::memory_order_release);
+}
+
+void writeCpuTrace() {
+    if (!cpuProfiler.enabled)
+        return;
+    std::lock_guard<std::mutex> lock(cpuProfiler.mutex);
+    FILE* file = fopen(cpuProfiler.path.c_str(), "w");
+    if (!file) {
+        std::cerr << "Failed to write trace " << cpuProfiler.path << std::endl;
+        return;
+    }
+    // Chrome trace_event: X - завершена зона, час у мікросекундах
+    fprintf(file, "{\"traceEvents\":[\n");
+    size_t written = 0;
+    for (const CpuTraceBuffer* buffer : cpuProfiler.buffers) {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+            written++ ? ",\n" : "", buffer->threadId, buffer->mainThread ? "main" : "worker", buffer->threadId);
+        uint64_t count = buffer->count.load(std::memory_order_acquire);
+        uint64_t first = count > CPU_TRACE_EVENTS ? count - CPU_TRACE_EVENTS : 0;
+        for (uint64_t i = first; i < count; ++i) {
+            const CpuTraceEvent& event = buffer->events[i % CPU_TRACE_EVENTS];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                event.name, buffer->threadId, event.start / 1000.0, event.duration / 1000.0);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    std::cout << "CPU trace written to " << cpuProfiler.path << std::endl;
+}
+
+struct CpuProfileZone {
+    const char* name;
+    std::chrono::steady_clock::time_point start;
+    CpuProfileZone(const char* zoneName) : name(cpuProfiler.enabled ? zoneName : NULL) {
+        if (name)
+            start = std::chrono::steady_clock::now();
+    }
+    ~CpuProfileZone() {
+        if (name)
+            recordCpuZone(name, start, std::chrono::steady_clock::now());
+    }
+};
+
+#define CPU_ZONE_JOIN2(a, b) a##b
+#define CPU_ZONE_JOIN(a, b) CPU_ZONE_JOIN2(a, b)
+#define CPU_ZONE(name) CpuProfileZone CPU_ZONE_JOIN(cpuZone, __LINE__)(name)
+#else
+#define CPU_ZONE(name)
+
+void startCpuProfiler(const std::string&) {
+    std::cerr << "CPU profiler is compiled out (SOLAR_CPU_PROFILER=0)" << std::endl;
+}
+
+void writeCpuTrace() {}
+#endif
+
 struct Material {
     glm::vec3 ambient;//фон.осв планети
     glm::vec3 specular;//альбедо
@@ -50,114 +215,3022 @@ struct CelestialBody {
     float axisTilt; 
     Material material; 
     std::string texturePath;
-    GLuint textureID;
+    int textureLayer; // шар у спільному масиві текстур тіл
+    int lodLevel = -1; // поточний рівень деталізації, -1 - ще не вибраний
+    int virtualTexture = -1; // індекс у virtualTextures, якщо для текстури є розбитий на сторінки .vt
+    float mass = 0.0f; // у масах Сонця; 0 - тіло не бере участі в N-тілах і летить по колу
+    int simulationIndex = -1; // індекс у nbody, поки симуляція керує положенням тіла
 };
 std::vector<CelestialBody> celestialBodies;
 
+// ланцюжок сфер від найгрубшої до найдетальнішої; поріг - радіус тіла на екрані в пікселях,
+// нижче якого рівень ще достатній
+struct SphereLodLevel {
+    unsigned int sectorCount;
+    unsigned int stackCount;
+    float maxPixelRadius;
+};
+const SphereLodLevel sphereLodLevels[] = {
+    { 8, 4, 4.0f },
+    { 16, 8, 16.0f },
+    { 36, 18, 64.0f },
+    { 64, 32, 192.0f },
+    { 128, 64, 1e30f },
+};
+const int SPHERE_LOD_COUNT = sizeof(sphereLodLevels) / sizeof(sphereLodLevels[0]);
+const float LOD_HYSTERESIS = 0.8f; // на грубший рівень - лише коли радіус впав на 20% нижче порогу
+float lodPixelScale = 1.0f;
+bool impostorMode = false; // тіла як квади з аналітичним перетином променя зі сферою
+const float IMPOSTOR_MIN_DISTANCE = 1.2f; // ближче (у радіусах) квад стає завеликим - лишається сітка
+
+struct BodyInstance {
+    glm::mat4 model;
+    glm::vec4 specularShininess; // xyz - specular, w - shininess
+    glm::vec4 emissionLayer; // xyz - emission, w - шар масиву текстур
+    glm::mat3 normalMatrix;
+    float textureMinLevel; // найдетальніший рівень шару, що вже в GPU
+    float virtualTexture;
+};
+
+struct QueuedBody {
+    int permutation;
+    int lod;
+    BodyInstance instance;
+};
+std::vector<QueuedBody> queuedBodies;
+
+struct Frustum {
+    glm::vec4 planes[6]; // xyz - нормаль всередину, w - відстань
+};
+
+struct CullStats {
+    int visible = 0;
+    int culled = 0;
+};
+Frustum cameraFrustum;
+CullStats cullStats;
+
+// std140: кожен vec3 вирівняний до 16 байт, тому на CPU це vec4
+struct CameraUniforms {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 viewPos;
+    glm::mat4 skyInverseViewProjection; // обернена до projection * обертання камери, для напрямку неба
+    glm::vec4 simulationTime; // x - day, для тіл, які анімує шейдер
+};
+
+struct LightUniforms {
+    glm::vec4 position;
+    glm::vec4 ambient;
+    glm::vec4 diffuse;
+    glm::vec4 specular;
+};
+
+// розміри віртуальних текстур і розкладка кешу сторінок; змінюється лише при завантаженні текстур
+const int MAX_VIRTUAL_TEXTURES = 4;
+struct VirtualTextureUniforms {
+    glm::vec4 size[MAX_VIRTUAL_TEXTURES];
+    glm::vec4 tileCacheLayout;
+};
+
+const GLuint CAMERA_UBO_BINDING = 0;
+const GLuint LIGHT_UBO_BINDING = 1;
+const GLuint VIRTUAL_TEXTURE_UBO_BINDING = 2;
+GLuint cameraUBO = 0;
+GLuint lightUBO = 0;
+GLuint virtualTextureUBO = 0;
+
+// один текст шейдерів, з якого збираються окремі програми через #define (див. ShaderPermutation);
+// IMPOSTOR замість трикутної сфери малює квад і перетинає промінь зі сферою у фрагментному шейдері,
+// FEEDBACK замість кольору пише, яка сторінка віртуальної текстури потрібна фрагменту,
+// ASTEROID рахує положення астероїда на орбіті з day і освітлює його у вершинах (POINTS - точкою)
 const char* vertexShaderSource = R"(
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoord;
 layout (location = 2) in vec3 aNormal;
+#ifdef ASTEROID
+layout (location = 3) in vec4 aOrbit; // x - радіус, y - фаза (град), z - кутова швидкість (град/день), w - нахил (рад)
+layout (location = 4) in vec4 aShape; // x - розмір, y - довгота вузла (рад), z - обертання (град/день), w - відтінок
+#else
+layout (location = 3) in mat4 aModel;
+layout (location = 7) in vec4 aSpecularShininess;
+layout (location = 8) in vec4 aEmissionLayer;
+layout (location = 9) in mat3 aNormalMatrix;
+layout (location = 12) in float aTextureMinLevel;
+layout (location = 13) in float aVirtualTexture;
+#endif
 
+#if defined(SKY)
+out vec3 SkyDirection;
+#elif defined(ASTEROID)
+out vec3 AsteroidColor;
+#elif defined(IMPOSTOR)
+out vec3 QuadPos;
+flat out vec3 SphereCenter;
+flat out float SphereRadius;
+flat out mat3 WorldToLocal;
+#else
 out vec2 TexCoord;
+#ifdef LIT
 out vec3 FragPos; 
 out vec3 Normal; 
+#endif
+#endif
+#ifdef LIT
+flat out vec3 MaterialSpecular;
+flat out float MaterialShininess;
+#endif
+#ifdef EMISSIVE_ONLY
+flat out vec3 MaterialEmission;
+#endif
+#if !defined(SKY) && !defined(ASTEROID)
+flat out float TextureLayer;
+flat out float TextureMinLevel;
+flat out float VirtualTexture;
+#endif
+
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    mat4 skyInverseViewProjection;
+    vec4 simulationTime; // x - day
+};
+
+#ifdef ASTEROID
+layout (std140) uniform Light {
+    vec3 position;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+} light;
+#endif
+
+void main() {
+#if defined(SKY)
+    // трикутник, що покриває весь екран, з z = w, тобто рівно на дальній площині
+    vec2 ndc = vec2(gl_VertexID == 1 ? 3.0 : -1.0, gl_VertexID == 2 ? 3.0 : -1.0);
+    vec4 farPoint = skyInverseViewProjection * vec4(ndc, 1.0, 1.0);
+    SkyDirection = farPoint.xyz / farPoint.w;
+    gl_Position = vec4(ndc, 1.0, 1.0);
+#elif defined(ASTEROID)
+    // орбіта як у computeBodyModel: поворот навколо Y на кут орбіти, потім зсув на радіус;
+    // нахил піднімає точку над площиною екліптики з нулем на лінії вузлів
+    float orbitAngle = radians(aOrbit.y + simulationTime.x * aOrbit.z);
+    vec3 center = aOrbit.x * vec3(cos(orbitAngle), sin(aOrbit.w) * sin(orbitAngle - aShape.y), -sin(orbitAngle));
+    vec3 toSun = normalize(light.position - center);
+    vec3 albedo = mix(vec3(0.35, 0.32, 0.30), vec3(0.62, 0.56, 0.50), aShape.w);
+#ifdef POINTS
+    // тіло менше за піксель: яскравість за освітленою часткою диска, яку видно з камери
+    float phase = 0.5 + 0.5 * dot(toSun, normalize(viewPos - center));
+    AsteroidColor = albedo * (light.ambient + light.diffuse * phase);
+    gl_Position = projection * view * vec4(center, 1.0);
+#else
+    float spin = radians(simulationTime.x * aShape.z);
+    mat3 spinRotation = mat3(cos(spin), 0.0, -sin(spin), 0.0, 1.0, 0.0, sin(spin), 0.0, cos(spin));
+    // еліпсоїд замість кулі, щоб каміння не було однаковим; нормаль еліпсоїда - aPos / stretch
+    vec3 stretch = vec3(1.0, 0.55 + 0.4 * aShape.w, 0.8);
+    vec3 normal = spinRotation * normalize(aPos / stretch);
+    vec4 worldPosition = vec4(center + spinRotation * (aPos * stretch) * aShape.x, 1.0);
+    AsteroidColor = albedo * (light.ambient + light.diffuse * max(dot(normal, toSun), 0.0));
+    gl_Position = projection * view * worldPosition;
+#endif
+#else
+#ifdef IMPOSTOR
+    // квад перпендикулярно до напрямку на камеру, розміром з переріз конуса видимості сфери
+    vec3 center = aModel[3].xyz;
+    float radius = length(aModel[0].xyz);
+    vec3 toCenter = center - viewPos;
+    float distance = length(toCenter);
+    vec3 forward = toCenter / distance;
+    vec3 up = abs(forward.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+    vec3 right = normalize(cross(forward, up));
+    up = cross(right, forward);
+    float halfSize = radius * distance / sqrt(max(distance * distance - radius * radius, 1e-6));
+    vec2 corner = vec2((gl_VertexID & 1) == 0 ? -1.0 : 1.0, (gl_VertexID & 2) == 0 ? -1.0 : 1.0);
+    vec4 worldPosition = vec4(center + (right * corner.x + up * corner.y) * halfSize, 1.0);
+    QuadPos = worldPosition.xyz;
+    SphereCenter = center;
+    SphereRadius = radius;
+    WorldToLocal = transpose(aNormalMatrix);
+#else
+   vec4 worldPosition = aModel * vec4(aPos, 1.0);
+    TexCoord = aTexCoord; 
+#ifdef LIT
+    FragPos = vec3(worldPosition); 
+    Normal = aNormalMatrix * aNormal; 
+#endif
+#endif
+#ifdef LIT
+    MaterialSpecular = aSpecularShininess.xyz;
+    MaterialShininess = aSpecularShininess.w;
+#endif
+#ifdef EMISSIVE_ONLY
+    MaterialEmission = aEmissionLayer.xyz;
+#endif
+    TextureLayer = aEmissionLayer.w;
+    TextureMinLevel = aTextureMinLevel;
+    VirtualTexture = aVirtualTexture;
+    gl_Position = projection * view * worldPosition; 
+#endif
+}
+)";
+
+const char* fragmentShaderSource = R"(
+#version 330 core
+// небо - звичайна 2D-текстура, тіла - шари одного масиву текстур
+struct Material {
+#ifdef SKY
+    sampler2D texture_diffuse;
+#else
+    sampler2DArray texture_diffuse;
+#endif
+};
+
+#if defined(SKY)
+in vec3 SkyDirection;
+#elif defined(ASTEROID)
+in vec3 AsteroidColor;
+#elif defined(IMPOSTOR)
+in vec3 QuadPos;
+flat in vec3 SphereCenter;
+flat in float SphereRadius;
+flat in mat3 WorldToLocal;
+#else
+in vec2 TexCoord;
+#ifdef LIT
+in vec3 FragPos;
+in vec3 Normal;
+#endif
+#endif
+#ifdef LIT
+flat in vec3 MaterialSpecular;
+flat in float MaterialShininess;
+#endif
+#ifdef EMISSIVE_ONLY
+flat in vec3 MaterialEmission;
+#endif
+#if !defined(SKY) && !defined(ASTEROID)
+flat in float TextureLayer;
+flat in float TextureMinLevel;
+flat in float VirtualTexture; // індекс віртуальної текстури, -1 - шар масиву
+#endif
+
+out vec4 FragColor;
+
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+    mat4 skyInverseViewProjection;
+    vec4 simulationTime; // x - day
+};
+
+#ifndef SKY
+layout (std140) uniform Light {
+    vec3 position;
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+} light;
+#endif
+
+uniform Material material;
+
+#ifndef SKY
+layout (std140) uniform VirtualTextures {
+    vec4 virtualTextureSize[4]; // xy - розмір рівня 0 у пікселях, z - кількість рівнів
+    vec4 tileCacheLayout;       // x - сторінка, y - рамка, z - розмір кешу в пікселях, w - зсув lod для FEEDBACK
+};
+uniform usampler2DArray pageTable; // rg - слот у кеші, b - рівень сторінки, що там лежить
+uniform sampler2D tileCache;
+
+float textureLodFor(vec2 du, vec2 dv, vec2 size) {
+    vec2 dx = du * size;
+    vec2 dy = dv * size;
+    return 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8));
+}
+
+int virtualLevel(int vt, float lod) {
+    return int(clamp(floor(lod + 0.5), 0.0, virtualTextureSize[vt].z - 1.0));
+}
+
+ivec2 virtualPage(vec2 uv, int vt, int level) {
+    vec2 pages = max(virtualTextureSize[vt].xy / (exp2(float(level)) * tileCacheLayout.x), 1.0);
+    return min(ivec2(uv * pages), ivec2(pages) - 1);
+}
+#endif
+
+#if !defined(SKY) && !defined(FEEDBACK) && !defined(ASTEROID)
+// якщо потрібної сторінки ще немає в кеші, таблиця сторінок вказує на найближчого завантаженого предка
+vec3 sampleVirtualTexture(vec2 texCoord, int vt, float lod) {
+    vec2 uv = vec2(fract(texCoord.x), clamp(texCoord.y, 0.0, 1.0));
+    int level = virtualLevel(vt, lod);
+    ivec2 page = virtualPage(uv, vt, level);
+    uvec4 entry = texelFetch(pageTable, ivec3(page, vt), level);
+    int residentLevel = int(entry.b);
+    ivec2 residentPage = page >> (residentLevel - level);
+    vec2 inTile = uv * virtualTextureSize[vt].xy / exp2(float(residentLevel)) - vec2(residentPage) * tileCacheLayout.x;
+    inTile = clamp(inTile, 0.0, tileCacheLayout.x);
+    vec2 cacheTexel = vec2(entry.rg) * (tileCacheLayout.x + 2.0 * tileCacheLayout.y) + tileCacheLayout.y + inTile;
+    return textureLod(tileCache, cacheTexel / tileCacheLayout.z, 0.0).rgb;
+}
+
+// шар, що ще довантажується, має лише грубі рівні: lod рахується вручну і не опускається
+// нижче найдетальнішого завантаженого рівня
+vec3 sampleBodyTexture(vec2 texCoord) {
+    vec2 du = dFdx(texCoord);
+    vec2 dv = dFdy(texCoord);
+    if (VirtualTexture >= 0.0) {
+        int vt = int(VirtualTexture);
+        return sampleVirtualTexture(texCoord, vt, textureLodFor(du, dv, virtualTextureSize[vt].xy));
+    }
+    float lod = textureLodFor(du, dv, vec2(textureSize(material.texture_diffuse, 0).xy));
+    return textureLod(material.texture_diffuse, vec3(texCoord, TextureLayer), max(lod, TextureMinLevel)).rgb;
+}
+#endif
+
+#if defined(EMISSIVE_ONLY)
+vec3 shadeBody(vec2 texCoord, vec3 fragPos, vec3 norm) {
+    // джерело світла в центрі тіла: дифузна і дзеркальна складові на його поверхні нульові
+    vec3 diffuseMap = sampleBodyTexture(texCoord);
+    return (light.ambient + MaterialEmission) * diffuseMap;
+}
+#elif defined(LIT)
+vec3 shadeBody(vec2 texCoord, vec3 fragPos, vec3 norm) {
+    vec3 diffuseMap = sampleBodyTexture(texCoord);
+    vec3 ambient = light.ambient * diffuseMap;
+    vec3 lightDir = normalize(light.position - fragPos);
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 diffuse = light.diffuse * diff * diffuseMap;
+    vec3 viewDir = normalize(viewPos - fragPos);
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), MaterialShininess);
+    vec3 specular = light.specular * (spec * MaterialSpecular);
+    return ambient + diffuse + specular;
+}
+#endif
+
+void main() {
+#if defined(SKY)
+    // рівнопроміжна проекція bg.jpeg за напрямком погляду
+    vec3 direction = normalize(SkyDirection);
+    float longitude = atan(direction.z, direction.x) / 6.28318530718;
+    float u1 = fract(longitude);
+    float u2 = fract(longitude + 0.5) - 0.5;
+    float u = fwidth(u1) <= fwidth(u2) + 1e-6 ? u1 : u2;
+    float v = asin(clamp(direction.y, -1.0, 1.0)) / 3.14159265359 + 0.5;
+    // bg.jpeg не 2:1, тож по горизонталі він повторюється, щоб зорі не розтягувались
+    vec2 size = vec2(textureSize(material.texture_diffuse, 0));
+    float repeats = max(floor(2.0 * size.y / size.x + 0.5), 1.0);
+    vec3 color = texture(material.texture_diffuse, vec2(u * repeats, v)).rgb;
+    FragColor = vec4(color, 1.0);
+#elif defined(ASTEROID)
+    FragColor = vec4(AsteroidColor, 1.0);
+#elif defined(FEEDBACK)
+    // буфер менший за екран, тож lod зсувається на log2 різниці розмірів; alpha 0 - сторінка не потрібна
+    vec2 du = dFdx(TexCoord);
+    vec2 dv = dFdy(TexCoord);
+    FragColor = vec4(0.0);
+    if (VirtualTexture >= 0.0) {
+        int vt = int(VirtualTexture);
+        float lod = textureLodFor(du, dv, virtualTextureSize[vt].xy) + tileCacheLayout.w;
+        int level = virtualLevel(vt, lod);
+        ivec2 page = virtualPage(vec2(fract(TexCoord.x), clamp(TexCoord.y, 0.0, 1.0)), vt, level);
+        FragColor = vec4(float(page.x), float(page.y), float(vt * 16 + level), 255.0) / 255.0;
+    }
+#elif defined(IMPOSTOR)
+    vec3 rayDir = normalize(QuadPos - viewPos);
+    vec3 oc = viewPos - SphereCenter;
+    float b = dot(oc, rayDir);
+    float h = b * b - (dot(oc, oc) - SphereRadius * SphereRadius);
+    float t = -b - sqrt(max(h, 0.0));
+    vec3 fragPos = viewPos + t * rayDir;
+    vec3 norm = (fragPos - SphereCenter) / SphereRadius;
+
+    // та сама розгортка, що й у generateSphere: s - кут сектора, t - від північного полюса
+    vec3 local = WorldToLocal * norm;
+    float sector = atan(local.z, local.x) / 6.28318530718;
+    float s1 = fract(sector);
+    float s2 = fract(sector + 0.5) - 0.5;
+    // на шві atan стрибає на 1, тож береться та з двох координат, що там неперервна
+    float s = fwidth(s1) <= fwidth(s2) + 1e-6 ? s1 : s2;
+    vec2 texCoord = vec2(s, acos(clamp(local.y, -1.0, 1.0)) / 3.14159265359);
+
+    vec4 clipPos = projection * view * vec4(fragPos, 1.0);
+    gl_FragDepth = clipPos.z / clipPos.w * 0.5 + 0.5;
+    FragColor = vec4(shadeBody(texCoord, fragPos, norm), 1.0);
+    if (h < 0.0)
+        discard;
+#else
+#ifdef LIT
+    FragColor = vec4(shadeBody(TexCoord, FragPos, normalize(Normal)), 1.0);
+#else
+    FragColor = vec4(shadeBody(TexCoord, vec3(0.0), vec3(0.0)), 1.0);
+#endif
+#endif
+}
+)";
+
+enum ShaderPermutation {
+    PERMUTATION_SKY,
+    PERMUTATION_EMISSIVE_ONLY,
+    PERMUTATION_LIT,
+    PERMUTATION_EMISSIVE_ONLY_IMPOSTOR,
+    PERMUTATION_LIT_IMPOSTOR,
+    PERMUTATION_FEEDBACK,
+    PERMUTATION_ASTEROID,
+    PERMUTATION_ASTEROID_POINTS,
+    PERMUTATION_COUNT
+};
+
+const char* permutationDefines[PERMUTATION_COUNT] = {
+    "#define SKY\n",
+    "#define EMISSIVE_ONLY\n",
+    "#define LIT\n",
+    "#define EMISSIVE_ONLY\n#define IMPOSTOR\n",
+    "#define LIT\n#define IMPOSTOR\n",
+    "#define FEEDBACK\n",
+    "#define ASTEROID\n",
+    "#define ASTEROID\n#define POINTS\n",
+};
+
+const char* permutationNames[PERMUTATION_COUNT] = {
+    "sky",
+    "emissive",
+    "lit",
+    "emissive impostors",
+    "lit impostors",
+    "vt feedback",
+    "asteroids",
+    "asteroid points",
+};
+
+bool isImpostorPermutation(int permutation) {
+    return permutation == PERMUTATION_EMISSIVE_ONLY_IMPOSTOR || permutation == PERMUTATION_LIT_IMPOSTOR;
+}
+
+// glad згенерований лише для GL 3.3, тож функції новіших версій і розширень
+// завантажуються вручну через той самий loader
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RGB8_ETC2 0x9274
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+struct GLExtensions {
+    bool programBinary = false;
+    PFNGLGETPROGRAMBINARYPROC GetProgramBinary = NULL;
+    PFNGLPROGRAMBINARYPROC ProgramBinary = NULL;
+    PFNGLPROGRAMPARAMETERIPROC ProgramParameteri = NULL;
+    bool textureBC1 = false;
+    bool textureBC7 = false;
+    bool textureETC2 = false;
+    bool bufferStorage = false;
+    PFNGLBUFFERSTORAGEPROC BufferStorage = NULL;
+};
+GLExtensions glExt;
+
+bool hasGLExtension(const char* name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; ++i) {
+        const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+        if (extension && strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool hasGLVersion(int major, int minor) {
+    return GLVersion.major > major || (GLVersion.major == major && GLVersion.minor >= minor);
+}
+
+void loadGLExtensions(GLADloadproc load) {
+    if (hasGLVersion(4, 1) || hasGLExtension("GL_ARB_get_program_binary")) {
+        glExt.GetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)load("glGetProgramBinary");
+        glExt.ProgramBinary = (PFNGLPROGRAMBINARYPROC)load("glProgramBinary");
+        glExt.ProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)load("glProgramParameteri");
+        GLint formatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+        glExt.programBinary = glExt.GetProgramBinary && glExt.ProgramBinary && glExt.ProgramParameteri && formatCount > 0;
+    }
+    glExt.textureBC1 = hasGLExtension("GL_EXT_texture_compression_s3tc") || hasGLExtension("GL_EXT_texture_compression_dxt1");
+    glExt.textureBC7 = hasGLVersion(4, 2) || hasGLExtension("GL_ARB_texture_compression_bptc");
+    glExt.textureETC2 = hasGLVersion(4, 3) || hasGLExtension("GL_ARB_ES3_compatibility");
+    if (hasGLVersion(4, 4) || hasGLExtension("GL_ARB_buffer_storage")) {
+        glExt.BufferStorage = (PFNGLBUFFERSTORAGEPROC)load("glBufferStorage");
+        glExt.bufferStorage = glExt.BufferStorage != NULL;
+    }
+}
+
+struct ShaderUniform {
+    GLint location;
+    GLenum type;
+    GLint size;
+};
+
+struct ShaderProgram {
+    GLuint id = 0;
+    std::unordered_map<std::string, ShaderUniform> uniforms;
+    std::unordered_map<std::string, GLuint> uniformBlocks;
+};
+
+// один раз після glLinkProgram: таблиця всіх активних uniform-ів програми
+ShaderProgram reflectShaderProgram(GLuint programID) {
+    ShaderProgram program;
+    program.id = programID;
+
+    GLint uniformCount = 0, maxNameLength = 0;
+    glGetProgramiv(programID, GL_ACTIVE_UNIFORMS, &uniformCount);
+    glGetProgramiv(programID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+    std::vector<char> nameBuffer(maxNameLength > 0 ? maxNameLength : 1);
+
+    for (GLint i = 0; i < uniformCount; ++i) {
+        GLsizei nameLength = 0;
+        ShaderUniform uniform;
+        glGetActiveUniform(programID, (GLuint)i, (GLsizei)nameBuffer.size(), &nameLength, &uniform.size, &uniform.type, nameBuffer.data());
+        std::string name(nameBuffer.data(), nameLength);
+        if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+            name.resize(name.size() - 3);
+        uniform.location = glGetUniformLocation(programID, name.c_str());
+        if (uniform.location >= 0)
+            program.uniforms[name] = uniform;
+    }
+
+    GLint blockCount = 0, maxBlockNameLength = 0;
+    glGetProgramiv(programID, GL_ACTIVE_UNIFORM_BLOCKS, &blockCount);
+    glGetProgramiv(programID, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxBlockNameLength);
+    std::vector<char> blockNameBuffer(maxBlockNameLength > 0 ? maxBlockNameLength : 1);
+    for (GLint i = 0; i < blockCount; ++i) {
+        GLsizei nameLength = 0;
+        glGetActiveUniformBlockName(programID, (GLuint)i, (GLsizei)blockNameBuffer.size(), &nameLength, blockNameBuffer.data());
+        program.uniformBlocks[std::string(blockNameBuffer.data(), nameLength)] = (GLuint)i;
+    }
+    return program;
+}
+
+void bindUniformBlock(const ShaderProgram& program, const std::string& name, GLuint bindingPoint) {
+    auto it = program.uniformBlocks.find(name);
+    if (it == program.uniformBlocks.end()) {
+        std::cout << "Uniform block not active in shader program: " << name << std::endl;
+        return;
+    }
+    glUniformBlockBinding(program.id, it->second, bindingPoint);
+}
+
+struct UniformMat4 {
+    static const GLenum glType = GL_FLOAT_MAT4;
+    GLint location = -1;
+    void set(const glm::mat4& value) const { glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value)); }
+};
+
+struct UniformVec3 {
+    static const GLenum glType = GL_FLOAT_VEC3;
+    GLint location = -1;
+    void set(const glm::vec3& value) const { glUniform3fv(location, 1, glm::value_ptr(value)); }
+};
+
+struct UniformInt {
+    static const GLenum glType = GL_INT;
+    GLint location = -1;
+    void set(int value) const { glUniform1i(location, value); }
+};
+
+struct UniformSampler2D {
+    static const GLenum glType = GL_SAMPLER_2D;
+    GLint location = -1;
+    void set(int textureUnit) const { glUniform1i(location, textureUnit); }
+};
+
+struct UniformSampler2DArray {
+    static const GLenum glType = GL_SAMPLER_2D_ARRAY;
+    GLint location = -1;
+    void set(int textureUnit) const { glUniform1i(location, textureUnit); }
+};
+
+struct UniformUSampler2DArray {
+    static const GLenum glType = GL_UNSIGNED_INT_SAMPLER_2D_ARRAY;
+    GLint location = -1;
+    void set(int textureUnit) const { glUniform1i(location, textureUnit); }
+};
+
+template <typename Handle>
+Handle findUniform(const ShaderProgram& program, const std::string& name) {
+    Handle handle;
+    auto it = program.uniforms.find(name);
+    if (it == program.uniforms.end()) {
+        std::cout << "Uniform not active in shader program: " << name << std::endl;
+        return handle;
+    }
+    if (it->second.type != Handle::glType) {
+        std::cout << "Uniform type mismatch: " << name << std::endl;
+        return handle;
+    }
+    handle.location = it->second.location;
+    return handle;
+}
+
+struct SceneProgram {
+    ShaderProgram program;
+    UniformSampler2D skyTexture;
+    UniformSampler2DArray bodyTextures;
+    UniformUSampler2DArray pageTable;
+    UniformSampler2D tileCache;
+};
+
+// юніт 0 - текстура неба або масив тіл, 1 і 2 - таблиця сторінок і кеш віртуальних текстур
+const int PAGE_TABLE_TEXTURE_UNIT = 1;
+const int TILE_CACHE_TEXTURE_UNIT = 2;
+
+GLuint compileShader(GLenum type, const char* source, const char* defines) {
+    CPU_ZONE("compileShader");
+    // #define мають іти після рядка #version
+    std::string text(source);
+    size_t versionEnd = text.find('\n', text.find("#version")) + 1;
+    text.insert(versionEnd, defines);
+    const char* textPtr = text.c_str();
+
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &textPtr, NULL);
+    glCompileShader(shader);
+
+    GLint compiled = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (!compiled) {
+        char infoLog[1024];
+        glGetShaderInfoLog(shader, sizeof(infoLog), NULL, infoLog);
+        std::cerr << "Shader compile failed (" << defines << "): " << infoLog << std::endl;
+    }
+    return shader;
+}
+
+GLuint buildShaderProgram(const char* vertexSource, const char* fragmentSource, const char* defines) {
+    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource, defines);
+    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource, defines);
+
+    GLuint shaderProgram = glCreateProgram();
+    glAttachShader(shaderProgram, vertexShader);
+    glAttachShader(shaderProgram, fragmentShader);
+    if (glExt.programBinary)
+        glExt.ProgramParameteri(shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(shaderProgram);
+
+    GLint linked = 0;
+    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        char infoLog[1024];
+        glGetProgramInfoLog(shaderProgram, sizeof(infoLog), NULL, infoLog);
+        std::cerr << "Shader program link failed (" << defines << "): " << infoLog << std::endl;
+    }
+
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    return shaderProgram;
+}
+
+const char* SHADER_CACHE_DIR = "shader_cache";
+const uint32_t SHADER_CACHE_MAGIC = 0x42505353; // "SSPB"
+const uint32_t SHADER_CACHE_VERSION = 1;
+
+uint64_t fnv1a64(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+bool makeDirectory(const char* path) {
+#ifdef _WIN32
+    return _mkdir(path) == 0 || errno == EEXIST;
+#else
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+// бінарник програми дійсний лише для того самого драйвера, тому рядки драйвера входять у ключ
+std::string shaderDriverString() {
+    std::string driver;
+    driver += (const char*)glGetString(GL_VENDOR);
+    driver += '|';
+    driver += (const char*)glGetString(GL_RENDERER);
+    driver += '|';
+    driver += (const char*)glGetString(GL_VERSION);
+    return driver;
+}
+
+// скільки байтів лишилося від поточної позиції до кінця файлу; -1, якщо не вдалося дізнатися
+long remainingFileBytes(FILE* file) {
+    long position = ftell(file);
+    if (position < 0 || fseek(file, 0, SEEK_END) != 0)
+        return -1;
+    long end = ftell(file);
+    if (fseek(file, position, SEEK_SET) != 0)
+        return -1;
+    return end - position;
+}
+
+bool loadCachedProgram(GLuint program, const std::string& path, uint64_t key, const std::string& driver) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    bool loaded = false;
+    uint32_t header[2] = { 0, 0 };
+    uint64_t storedKey = 0;
+    uint32_t driverLength = 0;
+    if (fread(header, sizeof(header), 1, file) == 1 && header[0] == SHADER_CACHE_MAGIC && header[1] == SHADER_CACHE_VERSION
+        && fread(&storedKey, sizeof(storedKey), 1, file) == 1 && storedKey == key
+        && fread(&driverLength, sizeof(driverLength), 1, file) == 1 && driverLength == driver.size()) {
+        std::string storedDriver(driverLength, '\0');
+        GLenum binaryFormat = 0;
+        uint32_t binaryLength = 0;
+        if (fread(&storedDriver[0], 1, driverLength, file) == driverLength && storedDriver == driver
+            && fread(&binaryFormat, sizeof(binaryFormat), 1, file) == 1
+            && fread(&binaryLength, sizeof(binaryLength), 1, file) == 1
+            && binaryLength > 0 && (long)binaryLength == remainingFileBytes(file)) {
+            // довжина перевірена за розміром файлу: обрізаний чи пошкоджений кеш - це промах, а не bad_alloc
+            std::vector<char> binary(binaryLength);
+            if (fread(binary.data(), 1, binaryLength, file) == binaryLength) {
+                glExt.ProgramBinary(program, binaryFormat, binary.data(), (GLsizei)binaryLength);
+                GLint linked = 0;
+                glGetProgramiv(program, GL_LINK_STATUS, &linked);
+                loaded = linked != 0;
+            }
+        }
+    }
+    fclose(file);
+    return loaded;
+}
+
+void saveCachedProgram(GLuint program, const std::string& path, uint64_t key, const std::string& driver) {
+    GLint binaryLength = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+    if (binaryLength <= 0)
+        return;
+    std::vector<char> binary(binaryLength);
+    GLenum binaryFormat = 0;
+    glExt.GetProgramBinary(program, binaryLength, NULL, &binaryFormat, binary.data());
+
+    makeDirectory(SHADER_CACHE_DIR);
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file)
+        return;
+    uint32_t header[2] = { SHADER_CACHE_MAGIC, SHADER_CACHE_VERSION };
+    uint32_t driverLength = (uint32_t)driver.size();
+    uint32_t length = (uint32_t)binaryLength;
+    fwrite(header, sizeof(header), 1, file);
+    fwrite(&key, sizeof(key), 1, file);
+    fwrite(&driverLength, sizeof(driverLength), 1, file);
+    fwrite(driver.data(), 1, driver.size(), file);
+    fwrite(&binaryFormat, sizeof(binaryFormat), 1, file);
+    fwrite(&length, sizeof(length), 1, file);
+    fwrite(binary.data(), 1, binary.size(), file);
+    fclose(file);
+}
+
+// програма з дискового кешу glProgramBinary; при будь-якій розбіжності - компіляція з тексту
+GLuint buildShaderProgramCached(const char* vertexSource, const char* fragmentSource, const char* defines, bool* fromCache = NULL) {
+    CPU_ZONE("buildShaderProgram");
+    if (fromCache)
+        *fromCache = false;
+    if (!glExt.programBinary)
+        return buildShaderProgram(vertexSource, fragmentSource, defines);
+
+    std::string driver = shaderDriverString();
+    uint64_t key = fnv1a64(vertexSource, strlen(vertexSource));
+    key = fnv1a64(fragmentSource, strlen(fragmentSource), key);
+    key = fnv1a64(defines, strlen(defines), key);
+    key = fnv1a64(driver.data(), driver.size(), key);
+    char fileName[64];
+    snprintf(fileName, sizeof(fileName), "/%016llx.bin", (unsigned long long)key);
+    std::string path = std::string(SHADER_CACHE_DIR) + fileName;
+
+    GLuint program = glCreateProgram();
+    if (loadCachedProgram(program, path, key, driver)) {
+        if (fromCache)
+            *fromCache = true;
+        return program;
+    }
+    glDeleteProgram(program);
+
+    program = buildShaderProgram(vertexSource, fragmentSource, defines);
+    GLint linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked)
+        saveCachedProgram(program, path, key, driver);
+    return program;
+}
+
+SceneProgram createSceneProgram(GLuint programID, int permutation) {
+    SceneProgram scene;
+    scene.program = reflectShaderProgram(programID);
+    bindUniformBlock(scene.program, "Camera", CAMERA_UBO_BINDING);
+    // текстурний юніт не змінюється, тож задається один раз
+    glUseProgram(programID);
+    if (permutation == PERMUTATION_SKY) {
+        scene.skyTexture = findUniform<UniformSampler2D>(scene.program, "material.texture_diffuse");
+        scene.skyTexture.set(0);
+    }
+    else if (permutation == PERMUTATION_FEEDBACK) {
+        bindUniformBlock(scene.program, "VirtualTextures", VIRTUAL_TEXTURE_UBO_BINDING);
+    }
+    else if (permutation == PERMUTATION_ASTEROID || permutation == PERMUTATION_ASTEROID_POINTS) {
+        bindUniformBlock(scene.program, "Light", LIGHT_UBO_BINDING);
+    }
+    else {
+        scene.bodyTextures = findUniform<UniformSampler2DArray>(scene.program, "material.texture_diffuse");
+        scene.bodyTextures.set(0);
+        scene.pageTable = findUniform<UniformUSampler2DArray>(scene.program, "pageTable");
+        scene.pageTable.set(PAGE_TABLE_TEXTURE_UNIT);
+        scene.tileCache = findUniform<UniformSampler2D>(scene.program, "tileCache");
+        scene.tileCache.set(TILE_CACHE_TEXTURE_UNIT);
+        bindUniformBlock(scene.program, "Light", LIGHT_UBO_BINDING);
+        bindUniformBlock(scene.program, "VirtualTextures", VIRTUAL_TEXTURE_UBO_BINDING);
+    }
+    return scene;
+}
+
+void createFrameUniformBuffers() {
+    glGenBuffers(1, &cameraUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, cameraUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraUniforms), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_UBO_BINDING, cameraUBO);
+
+    glGenBuffers(1, &lightUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, lightUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(LightUniforms), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, LIGHT_UBO_BINDING, lightUBO);
+
+    // нулі, поки віртуальних текстур немає: шейдер їх тоді не читає
+    VirtualTextureUniforms virtualTextures;
+    for (int i = 0; i < MAX_VIRTUAL_TEXTURES; ++i)
+        virtualTextures.size[i] = glm::vec4(0.0f);
+    virtualTextures.tileCacheLayout = glm::vec4(0.0f);
+    glGenBuffers(1, &virtualTextureUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, virtualTextureUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(VirtualTextureUniforms), &virtualTextures, GL_STATIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, VIRTUAL_TEXTURE_UBO_BINDING, virtualTextureUBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// камера і світло однакові для всього кадру: один запис на кадр замість запису на кожне тіло
+void updateFrameUniforms(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos) {
+    CameraUniforms camera;
+    camera.view = view;
+    camera.projection = projection;
+    camera.viewPos = glm::vec4(viewPos, 1.0f);
+    camera.skyInverseViewProjection = glm::inverse(projection * glm::mat4(glm::mat3(view)));
+    camera.simulationTime = glm::vec4(day, 0.0f, 0.0f, 0.0f);
+    glBindBuffer(GL_UNIFORM_BUFFER, cameraUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraUniforms), &camera);
+
+    LightUniforms light;
+    light.position = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    light.ambient = glm::vec4(0.2f, 0.2f, 0.2f, 0.0f);
+    light.diffuse = glm::vec4(0.8f, 0.8f, 0.8f, 0.0f);
+    light.specular = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+    glBindBuffer(GL_UNIFORM_BUFFER, lightUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(LightUniforms), &light);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// GPU-час іменованих проходів: glQueryCounter(GL_TIMESTAMP) на початку і в кінці кожного scope
+// (мітки, на відміну від GL_TIME_ELAPSED, можуть вкладатися). результати кадру читаються через
+// GPU_PROFILER_FRAMES кадрів, коли вони вже готові, тож профілювання не чекає на GPU
+const int GPU_PROFILER_FRAMES = 4;
+const int GPU_PROFILER_MAX_SCOPES = 32;
+const double GPU_PROFILER_REPORT_SECONDS = 1.0;
+
+struct GpuProfilerFrame {
+    GLuint queries[GPU_PROFILER_MAX_SCOPES * 2];
+    const char* names[GPU_PROFILER_MAX_SCOPES];
+    int scopeCount = 0;
+    bool pending = false;
+};
+
+// сума і максимум за поточне вікно звіту
+struct GpuScopeStats {
+    const char* name;
+    double totalMs;
+    double maxMs;
+    int samples;
+};
+
+struct GpuProfiler {
+    bool enabled = false;
+    bool report = true; // щосекундний звіт у stdout; --benchmark збирає лише час кадрів
+    GpuProfilerFrame frames[GPU_PROFILER_FRAMES];
+    int frame = 0;
+    std::vector<GpuScopeStats> stats;
+    std::chrono::steady_clock::time_point windowStart;
+    int recordFrom = -1; // з якого кадру зберігати повний час кадру у frameMs; -1 - не зберігати
+    std::vector<double> frameMs;
+};
+GpuProfiler gpuProfiler;
+
+void startGpuProfiler(GpuProfiler& profiler) {
+    profiler.enabled = true;
+    for (int i = 0; i < GPU_PROFILER_FRAMES; ++i)
+        glGenQueries(GPU_PROFILER_MAX_SCOPES * 2, profiler.frames[i].queries);
+    profiler.windowStart = std::chrono::steady_clock::now();
+}
+
+void recordGpuScope(GpuProfiler& profiler, const char* name, double ms) {
+    for (size_t i = 0; i < profiler.stats.size(); ++i) {
+        if (strcmp(profiler.stats[i].name, name) == 0) {
+            profiler.stats[i].totalMs += ms;
+            profiler.stats[i].maxMs = std::max(profiler.stats[i].maxMs, ms);
+            ++profiler.stats[i].samples;
+            return;
+        }
+    }
+    GpuScopeStats stats = { name, ms, ms, 1 };
+    profiler.stats.push_back(stats);
+}
+
+void reportGpuProfiler(GpuProfiler& profiler) {
+    auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - profiler.windowStart).count() < GPU_PROFILER_REPORT_SECONDS)
+        return;
+    profiler.windowStart = now;
+    if (profiler.stats.empty() || !profiler.report) {
+        profiler.stats.clear();
+        return;
+    }
+    std::string report = "GPU ms (avg/max):";
+    char line[128];
+    for (size_t i = 0; i < profiler.stats.size(); ++i) {
+        const GpuScopeStats& stats = profiler.stats[i];
+        snprintf(line, sizeof(line), " %s %.3f/%.3f", stats.name, stats.totalMs / stats.samples, stats.maxMs);
+        report += line;
+        report += i + 1 < profiler.stats.size() ? "," : "";
+    }
+    std::cout << report << std::endl;
+    profiler.stats.clear();
+}
+
+// на початку кадру: забирає результати кадру, що писав у цей самий набір запитів GPU_PROFILER_FRAMES кадрів тому
+void beginGpuFrame(GpuProfiler& profiler) {
+    if (!profiler.enabled)
+        return;
+    GpuProfilerFrame& frame = profiler.frames[profiler.frame % GPU_PROFILER_FRAMES];
+    if (frame.pending) {
+        // вкладені scope закінчуються не в порядку індексів, тож перевіряються всі мітки
+        GLint available = 1;
+        for (int query = 0; query < frame.scopeCount * 2 && available; ++query)
+            glGetQueryObjectiv(frame.queries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 frameBegin = ~(GLuint64)0, frameEnd = 0;
+            for (int scope = 0; scope < frame.scopeCount; ++scope) {
+                GLuint64 begin = 0, end = 0;
+                glGetQueryObjectui64v(frame.queries[scope * 2], GL_QUERY_RESULT, &begin);
+                glGetQueryObjectui64v(frame.queries[scope * 2 + 1], GL_QUERY_RESULT, &end);
+                recordGpuScope(profiler, frame.names[scope], (double)(end - begin) / 1.0e6);
+                frameBegin = std::min(frameBegin, begin);
+                frameEnd = std::max(frameEnd, end);
+            }
+            // кадр у цьому наборі запитів писався GPU_PROFILER_FRAMES кадрів тому
+            if (profiler.recordFrom >= 0 && profiler.frame - GPU_PROFILER_FRAMES >= profiler.recordFrom)
+                profiler.frameMs.push_back((double)(frameEnd - frameBegin) / 1.0e6);
+        }
+        // не готові навіть через кілька кадрів - кадр просто випадає зі статистики
+    }
+    frame.scopeCount = 0;
+    frame.pending = false;
+    reportGpuProfiler(profiler);
+}
+
+void endGpuFrame(GpuProfiler& profiler) {
+    if (!profiler.enabled)
+        return;
+    GpuProfilerFrame& frame = profiler.frames[profiler.frame % GPU_PROFILER_FRAMES];
+    frame.pending = frame.scopeCount > 0;
+    ++profiler.frame;
+}
+
+// дочекатися GPU і забрати результати всіх кадрів, що ще в польоті
+void flushGpuProfiler(GpuProfiler& profiler) {
+    if (!profiler.enabled)
+        return;
+    glFinish();
+    for (int i = 0; i < GPU_PROFILER_FRAMES; ++i) {
+        beginGpuFrame(profiler);
+        endGpuFrame(profiler);
+    }
+}
+
+// мітка початку; кінець ставить endGpuScope з тим самим індексом
+int beginGpuScope(GpuProfiler& profiler, const char* name) {
+    if (!profiler.enabled)
+        return -1;
+    GpuProfilerFrame& frame = profiler.frames[profiler.frame % GPU_PROFILER_FRAMES];
+    if (frame.scopeCount >= GPU_PROFILER_MAX_SCOPES)
+        return -1;
+    int scope = frame.scopeCount++;
+    frame.names[scope] = name;
+    glQueryCounter(frame.queries[scope * 2], GL_TIMESTAMP);
+    return scope;
+}
+
+void endGpuScope(GpuProfiler& profiler, int scope) {
+    if (scope < 0)
+        return;
+    GpuProfilerFrame& frame = profiler.frames[profiler.frame % GPU_PROFILER_FRAMES];
+    glQueryCounter(frame.queries[scope * 2 + 1], GL_TIMESTAMP);
+}
+
+struct GpuProfileScope {
+    int scope;
+    GpuProfileScope(const char* name) : scope(beginGpuScope(gpuProfiler, name)) {}
+    ~GpuProfileScope() { endGpuScope(gpuProfiler, scope); }
+};
+
+// стиснуті текстури: --bake перетворює jpg у KTX2 з готовими mip-рівнями поруч з оригіналом,
+// а loadTexture і buildTextureArray беруть .ktx2, якщо він є і драйвер знає формат
+enum TextureCodec {
+    TEXTURE_CODEC_BC1,
+    TEXTURE_CODEC_BC7,
+    TEXTURE_CODEC_ETC2,
+    TEXTURE_CODEC_COUNT
+};
+
+struct TextureCodecInfo {
+    const char* name;
+    uint32_t vkFormat;
+    GLenum glFormat;
+    uint32_t blockBytes;
+    uint8_t dfdColorModel;
+    uint8_t dfdChannel;
+};
+
+const TextureCodecInfo textureCodecs[TEXTURE_CODEC_COUNT] = {
+    { "bc1", 131, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 8, 128, 0 },  // VK_FORMAT_BC1_RGB_UNORM_BLOCK
+    { "bc7", 145, GL_COMPRESSED_RGBA_BPTC_UNORM, 16, 136, 0 },   // VK_FORMAT_BC7_UNORM_BLOCK
+    { "etc2", 147, GL_COMPRESSED_RGB8_ETC2, 8, 161, 2 },         // VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK
+};
+
+const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+bool textureCodecSupported(int codec) {
+    switch (codec) {
+    case TEXTURE_CODEC_BC1: return glExt.textureBC1;
+    case TEXTURE_CODEC_BC7: return glExt.textureBC7;
+    case TEXTURE_CODEC_ETC2: return glExt.textureETC2;
+    }
+    return false;
+}
+
+struct CompressedImage {
+    int codec = -1;
+    int width = 0;
+    int height = 0;
+    std::vector<std::vector<unsigned char>> levels; // від найбільшого рівня
+};
+
+std::string replaceExtension(const std::string& path, const char* extension) {
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return path + extension;
+    return path.substr(0, dot) + extension;
+}
+
+// pictures/terra.jpg -> pictures/terra.ktx2
+std::string bakedTexturePath(const std::string& texturePath) {
+    return replaceExtension(texturePath, ".ktx2");
+}
+
+uint32_t readU32(const std::vector<unsigned char>& bytes, size_t offset) {
+    uint32_t value;
+    memcpy(&value, &bytes[offset], sizeof(value));
+    return value;
+}
+
+uint64_t readU64(const std::vector<unsigned char>& bytes, size_t offset) {
+    uint64_t value;
+    memcpy(&value, &bytes[offset], sizeof(value));
+    return value;
+}
+
+// лише те, що пише сам baker: одна 2D-текстура без суперкомпресії
+bool loadKtx2(const std::string& path, CompressedImage& image) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+    std::vector<unsigned char> bytes;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        long size = ftell(file);
+        if (size > 0 && fseek(file, 0, SEEK_SET) == 0) {
+            bytes.resize((size_t)size);
+            if (fread(bytes.data(), 1, bytes.size(), file) != bytes.size())
+                bytes.clear();
+        }
+    }
+    fclose(file);
+    if (bytes.size() < 80 || memcmp(bytes.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0) {
+        std::cout << "Invalid KTX2 file: " << path << std::endl;
+        return false;
+    }
+
+    uint32_t vkFormat = readU32(bytes, 12);
+    image.codec = -1;
+    for (int codec = 0; codec < TEXTURE_CODEC_COUNT; ++codec) {
+        if (textureCodecs[codec].vkFormat == vkFormat)
+            image.codec = codec;
+    }
+    image.width = (int)readU32(bytes, 20);
+    image.height = (int)readU32(bytes, 24);
+    uint32_t depth = readU32(bytes, 28);
+    uint32_t layerCount = readU32(bytes, 32);
+    uint32_t faceCount = readU32(bytes, 36);
+    uint32_t levelCount = std::max(readU32(bytes, 40), 1u);
+    uint32_t supercompression = readU32(bytes, 44);
+    if (image.codec < 0 || image.width <= 0 || image.height <= 0 || depth != 0 || layerCount != 0 || faceCount != 1
+        || supercompression != 0 || levelCount > 32 || bytes.size() < 80 + 24 * (size_t)levelCount) {
+        std::cout << "Unsupported KTX2 file: " << path << std::endl;
+        return false;
+    }
+
+    const TextureCodecInfo& info = textureCodecs[image.codec];
+    image.levels.resize(levelCount);
+    for (uint32_t level = 0; level < levelCount; ++level) {
+        uint64_t offset = readU64(bytes, 80 + 24 * level);
+        uint64_t length = readU64(bytes, 80 + 24 * level + 8);
+        uint64_t blocksX = (std::max(image.width >> level, 1) + 3) / 4;
+        uint64_t blocksY = (std::max(image.height >> level, 1) + 3) / 4;
+        if (length != blocksX * blocksY * info.blockBytes || offset > bytes.size() || length > bytes.size() - offset) {
+            std::cout << "Corrupted KTX2 level " << level << ": " << path << std::endl;
+            return false;
+        }
+        image.levels[level].assign(bytes.begin() + (size_t)offset, bytes.begin() + (size_t)(offset + length));
+    }
+    return true;
+}
+
+// білінійне перемасштабування RGBA8
+void resampleImage(const unsigned char* source, int sourceWidth, int sourceHeight, unsigned char* target, int targetWidth, int targetHeight) {
+    for (int y = 0; y < targetHeight; ++y) {
+        float sourceY = ((y + 0.5f) * sourceHeight) / targetHeight - 0.5f;
+        int y0 = std::max(0, std::min(sourceHeight - 1, (int)floorf(sourceY)));
+        int y1 = std::min(sourceHeight - 1, y0 + 1);
+        float fy = std::max(0.0f, std::min(1.0f, sourceY - y0));
+        for (int x = 0; x < targetWidth; ++x) {
+            float sourceX = ((x + 0.5f) * sourceWidth) / targetWidth - 0.5f;
+            int x0 = std::max(0, std::min(sourceWidth - 1, (int)floorf(sourceX)));
+            int x1 = std::min(sourceWidth - 1, x0 + 1);
+            float fx = std::max(0.0f, std::min(1.0f, sourceX - x0));
+            for (int c = 0; c < 4; ++c) {
+                float top = source[(y0 * sourceWidth + x0) * 4 + c] * (1.0f - fx) + source[(y0 * sourceWidth + x1) * 4 + c] * fx;
+                float bottom = source[(y1 * sourceWidth + x0) * 4 + c] * (1.0f - fx) + source[(y1 * sourceWidth + x1) * 4 + c] * fx;
+                target[(y * targetWidth + x) * 4 + c] = (unsigned char)(top * (1.0f - fy) + bottom * fy + 0.5f);
+            }
+        }
+    }
+}
+
+// пул потоків для декодування зображень: GL-виклики лишаються на потоці контексту,
+// а воркери лише розпаковують jpg і перемасштабовують пікселі
+struct ThreadPool {
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable available;
+    bool stopping = false;
+
+    ~ThreadPool();
+};
+ThreadPool workerPool;
+
+void startThreadPool(ThreadPool& pool, unsigned int threadCount) {
+    pool.stopping = false;
+    for (unsigned int i = 0; i < threadCount; ++i) {
+        pool.workers.push_back(std::thread([&pool]() {
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(pool.mutex);
+                    pool.available.wait(lock, [&pool]() { return pool.stopping || !pool.tasks.empty(); });
+                    if (pool.tasks.empty())
+                        return;
+                    task = std::move(pool.tasks.front());
+                    pool.tasks.pop_front();
+                }
+                task();
+            }
+        }));
+    }
+}
+
+void submitTask(ThreadPool& pool, std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.tasks.push_back(std::move(task));
+    }
+    pool.available.notify_one();
+}
+
+// чекає, поки воркери доберуть усі задачі з черги
+void stopThreadPool(ThreadPool& pool) {
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.stopping = true;
+    }
+    pool.available.notify_all();
+    for (size_t i = 0; i < pool.workers.size(); ++i)
+        pool.workers[i].join();
+    pool.workers.clear();
+}
+
+ThreadPool::~ThreadPool() {
+    stopThreadPool(*this);
+}
+
+// файл, відображений у пам'ять лише для читання; звільняється явно через unmapFile
+struct MappedFile {
+    const unsigned char* data = NULL;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#endif
+};
+
+bool mapFile(const std::string& path, MappedFile& mapped) {
+#ifdef _WIN32
+    mapped.file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (mapped.file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(mapped.file, &size) && size.QuadPart > 0)
+        mapped.mapping = CreateFileMappingA(mapped.file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapped.mapping)
+        mapped.data = (const unsigned char*)MapViewOfFile(mapped.mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!mapped.data) {
+        if (mapped.mapping)
+            CloseHandle(mapped.mapping);
+        CloseHandle(mapped.file);
+        mapped = MappedFile();
+        return false;
+    }
+    mapped.size = (size_t)size.QuadPart;
+    return true;
+#else
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0)
+        return false;
+    struct stat info;
+    void* data = MAP_FAILED;
+    if (fstat(file, &info) == 0 && info.st_size > 0)
+        data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (data == MAP_FAILED)
+        return false;
+    // сторінки читаються наперед, поки файл ще у воркері, а не під час копіювання на GL-потоці
+    madvise(data, (size_t)info.st_size, MADV_WILLNEED);
+    mapped.data = (const unsigned char*)data;
+    mapped.size = (size_t)info.st_size;
+    return true;
+#endif
+}
+
+void unmapFile(MappedFile& mapped) {
+    if (!mapped.data)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(mapped.data);
+    CloseHandle(mapped.mapping);
+    CloseHandle(mapped.file);
+#else
+    munmap((void*)mapped.data, mapped.size);
+#endif
+    mapped = MappedFile();
+}
+
+struct DecodedImage {
+    std::string path;
+    int targetWidth = 0; // 0 - розмір і канали як у файлі, інакше RGBA8 цього розміру
+    int targetHeight = 0;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::vector<unsigned char> pixels;
+    bool mipChain = false; // розкласти pixels у повний mip-ланцюжок levels
+    std::vector<std::vector<unsigned char>> levels;
+    std::vector<const unsigned char*> levelPixels; // рівні з levels або прямо з відображеного кешу
+    MappedFile cache;
+    bool fromCache = false;
+};
+
+int mipLevelCount(int width, int height) {
+    int levels = 1;
+    while (width > 1 || height > 1) {
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+        ++levels;
+    }
+    return levels;
+}
+
+// наступний mip-рівень середнім 2x2; непарний край повторює останній рядок або стовпець
+void downsampleHalf(const unsigned char* source, int width, int height, int channels, std::vector<unsigned char>& target) {
+    int nextWidth = std::max(width / 2, 1), nextHeight = std::max(height / 2, 1);
+    target.resize((size_t)nextWidth * nextHeight * channels);
+    for (int y = 0; y < nextHeight; ++y) {
+        const unsigned char* row0 = source + (size_t)std::min(y * 2, height - 1) * width * channels;
+        const unsigned char* row1 = source + (size_t)std::min(y * 2 + 1, height - 1) * width * channels;
+        for (int x = 0; x < nextWidth; ++x) {
+            int x0 = std::min(x * 2, width - 1) * channels;
+            int x1 = std::min(x * 2 + 1, width - 1) * channels;
+            for (int c = 0; c < channels; ++c) {
+                int sum = row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c];
+                target[((size_t)y * nextWidth + x) * channels + c] = (unsigned char)((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+// mip-рівні середнім 2x2 ще у воркері, щоб GL-потік міг вантажити їх по одному без glGenerateMipmap
+void buildMipChain(DecodedImage& image) {
+    image.levels.clear();
+    image.levelPixels.clear();
+    if (image.pixels.empty())
+        return;
+    image.levels.push_back(std::vector<unsigned char>());
+    image.levels[0].swap(image.pixels);
+    int width = image.width, height = image.height;
+    const int channels = image.channels;
+    while (width > 1 || height > 1) {
+        std::vector<unsigned char> next;
+        downsampleHalf(image.levels.back().data(), width, height, channels, next);
+        image.levels.push_back(std::move(next));
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+    }
+    for (size_t level = 0; level < image.levels.size(); ++level)
+        image.levelPixels.push_back(image.levels[level].data());
+}
+
+// декодовані mip-ланцюжки на диску: теплий старт відображає файл і віддає вказівники на рівні
+// прямо в завантаження, без stbi_load і без копіювання. ключ - шлях, розмір і час зміни
+// джерела плюс розмір, до якого його перемасштабовано
+const char* TEXTURE_CACHE_DIR = "texture_cache";
+const uint32_t TEXTURE_CACHE_MAGIC = 0x58545353; // "SSTX"
+const uint32_t TEXTURE_CACHE_VERSION = 1;
+
+struct TextureCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t levelCount; // далі рівні підряд від найбільшого, без вирівнювання
+};
+
+bool decodedCacheKey(const DecodedImage& image, uint64_t& key) {
+#ifdef _WIN32
+    struct _stat64 info;
+    if (_stat64(image.path.c_str(), &info) != 0)
+        return false;
+#else
+    struct stat info;
+    if (stat(image.path.c_str(), &info) != 0)
+        return false;
+#endif
+    int64_t stamp[4] = { (int64_t)info.st_size, (int64_t)info.st_mtime, image.targetWidth, image.targetHeight };
+    key = fnv1a64(image.path.data(), image.path.size());
+    key = fnv1a64(stamp, sizeof(stamp), key);
+    return true;
+}
+
+std::string decodedCachePath(uint64_t key) {
+    char fileName[64];
+    snprintf(fileName, sizeof(fileName), "/%016llx.bin", (unsigned long long)key);
+    return std::string(TEXTURE_CACHE_DIR) + fileName;
+}
+
+size_t mipChainBytes(int width, int height, int channels, int levelCount) {
+    size_t bytes = 0;
+    for (int level = 0; level < levelCount; ++level)
+        bytes += (size_t)std::max(width >> level, 1) * std::max(height >> level, 1) * channels;
+    return bytes;
+}
+
+// --golden: кадр залежить лише від вихідних картинок, а не від того, що лишилося на диску після
+// --bake, --pack, --tile чи попередніх запусків (KTX2, assets.pack, texture_cache, .vt)
+bool sourceAssetsOnly = false;
+
+bool loadDecodedCache(DecodedImage& image) {
+    if (sourceAssetsOnly)
+        return false;
+    uint64_t key;
+    if (!decodedCacheKey(image, key) || !mapFile(decodedCachePath(key), image.cache))
+        return false;
+    TextureCacheHeader header;
+    bool valid = image.cache.size >= sizeof(header);
+    if (valid) {
+        memcpy(&header, image.cache.data, sizeof(header));
+        valid = header.magic == TEXTURE_CACHE_MAGIC && header.version == TEXTURE_CACHE_VERSION && header.key == key
+            && header.channels >= 1 && header.channels <= 4 && header.levelCount == (uint32_t)mipLevelCount(header.width, header.height)
+            && image.cache.size == sizeof(header) + mipChainBytes(header.width, header.height, header.channels, header.levelCount);
+    }
+    if (!valid) {
+        unmapFile(image.cache);
+        return false;
+    }
+    image.width = (int)header.width;
+    image.height = (int)header.height;
+    image.channels = (int)header.channels;
+    const unsigned char* level = image.cache.data + sizeof(header);
+    for (uint32_t i = 0; i < header.levelCount; ++i) {
+        image.levelPixels.push_back(level);
+        level += (size_t)std::max(image.width >> i, 1) * std::max(image.height >> i, 1) * image.channels;
+    }
+    image.fromCache = true;
+    return true;
+}
+
+// пишеться у тимчасовий файл і перейменовується, щоб інший запуск не відобразив недописаний
+void saveDecodedCache(const DecodedImage& image) {
+    uint64_t key;
+    if (sourceAssetsOnly || image.levels.empty() || !decodedCacheKey(image, key))
+        return;
+    makeDirectory(TEXTURE_CACHE_DIR);
+    std::string path = decodedCachePath(key);
+    std::string temporaryPath = path + ".tmp";
+    FILE* file = fopen(temporaryPath.c_str(), "wb");
+    if (!file)
+        return;
+    TextureCacheHeader header = { TEXTURE_CACHE_MAGIC, TEXTURE_CACHE_VERSION, key, (uint32_t)image.width, (uint32_t)image.height,
+        (uint32_t)image.channels, (uint32_t)image.levels.size() };
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t level = 0; written && level < image.levels.size(); ++level)
+        written = fwrite(image.levels[level].data(), 1, image.levels[level].size(), file) == image.levels[level].size();
+    written = fclose(file) == 0 && written;
+    remove(path.c_str());
+    if (!written || rename(temporaryPath.c_str(), path.c_str()) != 0)
+        remove(temporaryPath.c_str());
+}
+
+// один архів assets.pack замість окремих файлів: текстури у форматі texture_cache, рівні деталізації
+// сфери і тексти шейдерів. відображається один раз, а ресурси шукаються за ім'ям через
+// ідеальний хеш: fnv1a64 з підібраним затравочним значенням дає кожному імені власний слот
+const char* ASSET_PACK_PATH = "assets.pack";
+const uint32_t ASSET_PACK_MAGIC = 0x4B505353; // "SSPK"
+const uint32_t ASSET_PACK_VERSION = 2;
+const size_t ASSET_PACK_ALIGNMENT = 256;
+const uint32_t ASSET_PACK_EMPTY_SLOT = 0xFFFFFFFFu;
+
+enum AssetType {
+    ASSET_TEXTURE, // TextureCacheHeader і рівні
+    ASSET_MESH,    // PackedMeshHeader, PackedMeshLevel-и, вершини, індекси
+    ASSET_SHADER,  // текст із завершальним нулем
+};
+
+struct AssetPackHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t tableSize; // степінь двійки; слоти - індекси записів
+    uint64_t seed;
+};
+
+struct AssetPackEntry {
+    char name[48];
+    uint32_t type;
+    uint32_t sourceHash; // шейдери й сфери: хеш вбудованих даних, з яких зібрано запис; 0 - для текстур
+    uint64_t offset; // від початку файлу, кратний ASSET_PACK_ALIGNMENT
+    uint64_t size;
+};
+
+struct AssetPack {
+    MappedFile file;
+    const AssetPackHeader* header = NULL;
+    const AssetPackEntry* entries = NULL;
+    const uint32_t* table = NULL;
+};
+AssetPack assetPack;
+
+uint32_t assetPackSlot(const char* name, uint64_t seed, uint32_t tableSize) {
+    return (uint32_t)(fnv1a64(name, strlen(name), seed) & (tableSize - 1));
+}
+
+// pictures/terra.jpg -> terra.jpg: у архіві немає абсолютних шляхів
+std::string assetName(const std::string& path) {
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+bool openAssetPack(AssetPack& pack, const char* path) {
+    if (!mapFile(path, pack.file))
+        return false;
+    const AssetPackHeader* header = (const AssetPackHeader*)pack.file.data;
+    bool valid = pack.file.size >= sizeof(AssetPackHeader) && header->magic == ASSET_PACK_MAGIC && header->version == ASSET_PACK_VERSION
+        && header->tableSize > 0 && (header->tableSize & (header->tableSize - 1)) == 0
+        && pack.file.size >= sizeof(AssetPackHeader) + header->entryCount * sizeof(AssetPackEntry) + header->tableSize * sizeof(uint32_t);
+    if (valid) {
+        pack.header = header;
+        pack.entries = (const AssetPackEntry*)(pack.file.data + sizeof(AssetPackHeader));
+        pack.table = (const uint32_t*)(pack.entries + header->entryCount);
+        for (uint32_t i = 0; valid && i < header->entryCount; ++i)
+            valid = pack.entries[i].offset + pack.entries[i].size <= pack.file.size && pack.entries[i].name[sizeof(pack.entries[i].name) - 1] == '\0';
+    }
+    if (!valid) {
+        std::cout << "Ignoring invalid asset pack " << path << std::endl;
+        unmapFile(pack.file);
+        pack = AssetPack();
+        return false;
+    }
+    std::cout << "Asset pack " << path << ": " << header->entryCount << " assets, " << pack.file.size / (1024 * 1024) << " MB mapped" << std::endl;
+    return true;
+}
+
+uint32_t assetSourceHash(const void* data, size_t size) {
+    return (uint32_t)fnv1a64(data, size);
+}
+
+// вказівник прямо у відображений архів або NULL
+const unsigned char* findAsset(const AssetPack& pack, const std::string& name, AssetType type, size_t* size = NULL, uint32_t* sourceHash = NULL) {
+    if (!pack.header)
+        return NULL;
+    uint32_t index = pack.table[assetPackSlot(name.c_str(), pack.header->seed, pack.header->tableSize)];
+    if (index >= pack.header->entryCount)
+        return NULL;
+    const AssetPackEntry& entry = pack.entries[index];
+    if (entry.type != (uint32_t)type || name != entry.name)
+        return NULL;
+    if (size)
+        *size = (size_t)entry.size;
+    if (sourceHash)
+        *sourceHash = entry.sourceHash;
+    return pack.file.data + entry.offset;
+}
+
+// рівні текстури з архіву; розмір має збігатися з тим, до якого текстуру перемасштабували б
+bool loadPackedImage(DecodedImage& image) {
+    size_t size = 0;
+    const unsigned char* data = findAsset(assetPack, assetName(image.path), ASSET_TEXTURE, &size);
+    if (!data || size < sizeof(TextureCacheHeader))
+        return false;
+    TextureCacheHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != TEXTURE_CACHE_MAGIC || header.version != TEXTURE_CACHE_VERSION || header.channels < 1 || header.channels > 4
+        || header.levelCount != (uint32_t)mipLevelCount(header.width, header.height)
+        || size != sizeof(header) + mipChainBytes(header.width, header.height, header.channels, header.levelCount))
+        return false;
+    if (image.targetWidth > 0 && ((int)header.width != image.targetWidth || (int)header.height != image.targetHeight))
+        return false;
+    // той самий ключ, що й у texture_cache: якщо вихідна картинка поруч і змінилася після --pack,
+    // запис застарів. без вихідних файлів (лише архів) перевіряти нема з чим
+    uint64_t key;
+    if (decodedCacheKey(image, key) && header.key != key) {
+        std::cout << "Ignoring stale " + assetName(image.path) + " in the asset pack; rebuild it with --pack\n" << std::flush;
+        return false;
+    }
+    image.width = (int)header.width;
+    image.height = (int)header.height;
+    image.channels = (int)header.channels;
+    const unsigned char* level = data + sizeof(header);
+    for (uint32_t i = 0; i < header.levelCount; ++i) {
+        image.levelPixels.push_back(level);
+        level += (size_t)std::max(image.width >> i, 1) * std::max(image.height >> i, 1) * image.channels;
+    }
+    image.fromCache = true;
+    return true;
+}
+
+void decodeImage(DecodedImage& image) {
+    CPU_ZONE("decodeImage");
+    if (image.mipChain && (loadPackedImage(image) || loadDecodedCache(image)))
+        return;
+    int width, height, nrChannels;
+    bool resize = image.targetWidth > 0 && image.targetHeight > 0;
+    // прапорець переворота в stb_image глобальний; потокова версія не заважає іншим воркерам
+    stbi_set_flip_vertically_on_load_thread(1);
+    unsigned char* data = stbi_load(image.path.c_str(), &width, &height, &nrChannels, resize ? 4 : 0);
+    if (!data) {
+        std::cout << "Not found: " + image.path + "\n" << std::flush;
+        return;
+    }
+    if (!resize) {
+        image.width = width;
+        image.height = height;
+        image.channels = nrChannels;
+        image.pixels.assign(data, data + (size_t)width * height * nrChannels);
+    }
+    else {
+        image.width = image.targetWidth;
+        image.height = image.targetHeight;
+        image.channels = 4;
+        image.pixels.resize((size_t)image.width * image.height * 4);
+        if (width == image.width && height == image.height)
+            std::copy(data, data + image.pixels.size(), image.pixels.begin());
+        else
+            resampleImage(data, width, height, image.pixels.data(), image.width, image.height);
+    }
+    stbi_image_free(data);
+    if (image.mipChain) {
+        buildMipChain(image);
+        saveDecodedCache(image);
+    }
+}
+
+// зображення, що декодуються у пулі; головний потік забирає їх у порядку готовності
+struct DecodeBatch {
+    std::deque<DecodedImage> images; // deque: адреси не змінюються, поки воркери пишуть
+    std::deque<size_t> finished;
+    size_t pending = 0;
+    std::mutex mutex;
+    std::condition_variable done;
+};
+
+size_t submitDecode(ThreadPool& pool, DecodeBatch& batch, const std::string& path, int targetWidth = 0, int targetHeight = 0, bool mipChain = false) {
+    batch.images.push_back(DecodedImage());
+    DecodedImage* image = &batch.images.back();
+    image->path = path;
+    image->targetWidth = targetWidth;
+    image->targetHeight = targetHeight;
+    image->mipChain = mipChain;
+    size_t index = batch.images.size() - 1;
+    ++batch.pending;
+    submitTask(pool, [&batch, image, index]() {
+        decodeImage(*image);
+        std::lock_guard<std::mutex> lock(batch.mutex);
+        batch.finished.push_back(index);
+        batch.done.notify_one();
+    });
+    return index;
+}
+
+size_t waitForDecode(DecodeBatch& batch) {
+    std::unique_lock<std::mutex> lock(batch.mutex);
+    batch.done.wait(lock, [&batch]() { return !batch.finished.empty(); });
+    size_t index = batch.finished.front();
+    batch.finished.pop_front();
+    --batch.pending;
+    return index;
+}
+
+// те саме без очікування: false, якщо жодне зображення ще не готове
+bool pollDecode(DecodeBatch& batch, size_t& index) {
+    std::lock_guard<std::mutex> lock(batch.mutex);
+    if (batch.finished.empty())
+        return false;
+    index = batch.finished.front();
+    batch.finished.pop_front();
+    --batch.pending;
+    return true;
+}
+
+GLuint createTexture2D() {
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return textureID;
+}
+
+bool uploadBakedTexture2D(const std::string& texturePath) {
+    CompressedImage baked;
+    if (sourceAssetsOnly || !loadKtx2(bakedTexturePath(texturePath), baked) || !textureCodecSupported(baked.codec))
+        return false;
+    const TextureCodecInfo& info = textureCodecs[baked.codec];
+    for (size_t level = 0; level < baked.levels.size(); ++level) {
+        glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, info.glFormat, std::max(baked.width >> level, 1), std::max(baked.height >> level, 1),
+            0, (GLsizei)baked.levels[level].size(), baked.levels[level].data());
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)baked.levels.size() - 1);
+    return true;
+}
+
+GLenum pixelFormat(int channels) {
+    if (channels == 1)
+        return GL_RED;
+    if (channels == 4)
+        return GL_RGBA;
+    return GL_RGB;
+}
+
+void uploadDecodedTexture2D(const DecodedImage& image) {
+    if (image.pixels.empty())
+        return;
+    GLenum format = pixelFormat(image.channels);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels.data());
+    glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+GLuint loadTexture(const std::string& texturePath){
+    CPU_ZONE("loadTexture");
+    GLuint textureID = createTexture2D();
+    if (uploadBakedTexture2D(texturePath))
+        return textureID;
+
+    DecodedImage image;
+    image.path = texturePath;
+    decodeImage(image);
+    uploadDecodedTexture2D(image);
+    return textureID;
+}
+
+// усі текстури тіл, перемасштабовані до одного розміру, в одному GL_TEXTURE_2D_ARRAY:
+// одна прив'язка текстури на весь кадр, тож усі тіла можуть іти одним instanced-викликом
+struct TextureArray {
+    GLuint id = 0;
+    int width = 2048;
+    int height = 1024;
+    std::vector<std::string> layerPaths;
+    bool baked = false; // стиснуті шари з KTX2; RGBA8-шари в такий масив не довантажити
+    std::vector<int> residentLevel; // найдетальніший завантажений рівень кожного шару
+};
+TextureArray bodyTextures;
+
+int addTextureArrayLayer(TextureArray& textureArray, const std::string& texturePath) {
+    for (size_t layer = 0; layer < textureArray.layerPaths.size(); ++layer) {
+        if (textureArray.layerPaths[layer] == texturePath)
+            return (int)layer;
+    }
+    textureArray.layerPaths.push_back(texturePath);
+    return (int)textureArray.layerPaths.size() - 1;
+}
+
+// шари масиву мусять мати один формат, розмір і кількість рівнів, тож стиснутий шлях
+// береться лише тоді, коли всі тіла спечені однаково; інакше - jpg для всіх
+bool uploadBakedTextureArray(const TextureArray& textureArray) {
+    if (sourceAssetsOnly)
+        return false;
+    std::vector<CompressedImage> layers(textureArray.layerPaths.size());
+    for (size_t layer = 0; layer < layers.size(); ++layer) {
+        std::string path = bakedTexturePath(textureArray.layerPaths[layer]);
+        if (!loadKtx2(path, layers[layer]))
+            return false;
+        if (layers[layer].width != textureArray.width || layers[layer].height != textureArray.height
+            || layers[layer].codec != layers[0].codec || layers[layer].levels.size() != layers[0].levels.size()) {
+            std::cout << "Baked texture does not match the body texture array, using JPEG: " << path << std::endl;
+            return false;
+        }
+    }
+    if (layers.empty() || !textureCodecSupported(layers[0].codec)) {
+        if (!layers.empty())
+            std::cout << "Driver has no " << textureCodecs[layers[0].codec].name << " support, using JPEG" << std::endl;
+        return false;
+    }
+
+    const TextureCodecInfo& info = textureCodecs[layers[0].codec];
+    size_t totalBytes = 0;
+    std::vector<unsigned char> levelData;
+    for (size_t level = 0; level < layers[0].levels.size(); ++level) {
+        levelData.clear();
+        for (size_t layer = 0; layer < layers.size(); ++layer)
+            levelData.insert(levelData.end(), layers[layer].levels[level].begin(), layers[layer].levels[level].end());
+        glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, info.glFormat, std::max(textureArray.width >> level, 1),
+            std::max(textureArray.height >> level, 1), (GLsizei)layers.size(), 0, (GLsizei)levelData.size(), levelData.data());
+        totalBytes += levelData.size();
+    }
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, (GLint)layers[0].levels.size() - 1);
+    std::cout << "Body textures: " << layers.size() << " layers " << textureArray.width << "x" << textureArray.height
+        << " " << info.name << " (" << totalBytes / (1024 * 1024) << " MB)" << std::endl;
+    return true;
+}
+
+// створює масив і, якщо є спечені KTX2, одразу заповнює його; інакше виділяє всі рівні без даних,
+// а шари довантажуються потоком (див. TextureStreamer)
+bool beginTextureArray(TextureArray& textureArray) {
+    GLint maxLayers = 0;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    if ((GLint)textureArray.layerPaths.size() > maxLayers)
+        std::cout << "Too many texture array layers: " << textureArray.layerPaths.size() << " > " << maxLayers << std::endl;
+
+    glGenTextures(1, &textureArray.id);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray.id);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    const GLsizei layers = (GLsizei)textureArray.layerPaths.size();
+    if (uploadBakedTextureArray(textureArray)) {
+        textureArray.baked = true;
+        textureArray.residentLevel.assign(layers, 0);
+        return true;
+    }
+    const int levels = mipLevelCount(textureArray.width, textureArray.height);
+    for (int level = 0; level < levels; ++level) {
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, std::max(textureArray.width >> level, 1), std::max(textureArray.height >> level, 1),
+            layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    // поки шар не завантажено, тіло сіре: найгрубший рівень 1x1 заповнюється одразу
+    std::vector<unsigned char> placeholder((size_t)layers * 4, (unsigned char)128);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, levels - 1, 0, 0, 0, 1, 1, layers, GL_RGBA, GL_UNSIGNED_BYTE, placeholder.data());
+    textureArray.residentLevel.assign(layers, levels - 1);
+    std::cout << "Body textures: " << layers << " layers " << textureArray.width << "x" << textureArray.height
+        << " RGBA8 (" << (size_t)layers * textureArray.width * textureArray.height * 4 * 4 / 3 / (1024 * 1024) << " MB), streaming" << std::endl;
+    return false;
+}
+
+// декодовані текстури йдуть у GPU частинами через кільце PBO: за кадр копіюється не більше бюджету
+// байтів, а glTexSubImage читає з буфера без очікування GL-потоку. рівні вантажаться від
+// найгрубшого, тож тіло одразу показує розмиту текстуру, яка уточнюється з кожним рівнем
+const int UPLOAD_RING_SEGMENTS = 3;
+const size_t DEFAULT_UPLOAD_BUDGET = 4 * 1024 * 1024; // байтів на кадр, він же розмір сегмента кільця
+
+struct UploadRing {
+    GLuint buffer = 0;
+    unsigned char* persistent = NULL; // постійне відображення, якщо є glBufferStorage
+    size_t segmentSize = 0;
+    GLsync fences[UPLOAD_RING_SEGMENTS] = {};
+    int segment = 0;
+};
+
+struct TextureUpload {
+    size_t image; // індекс у DecodeBatch
+    int layer;    // шар масиву тіл, -1 - небо
+    int level;    // рівень, що вантажиться зараз; іде від найгрубшого до 0
+    int row;      // перший ще не скопійований рядок рівня
+};
+
+struct TextureStreamer {
+    UploadRing ring;
+    DecodeBatch batch;
+    std::vector<int> layerOfImage;
+    std::deque<TextureUpload> uploads;
+    TextureArray* bodies = NULL;
+    GLuint sky = 0;
+    std::chrono::steady_clock::time_point start;
+    bool reported = true;
+    size_t uploadedBytes = 0;
+};
+TextureStreamer textureStreamer;
+
+void createUploadRing(UploadRing& ring, size_t segmentSize) {
+    // у сегмент має влазити хоча б один рядок найширшої текстури
+    ring.segmentSize = std::max(segmentSize, (size_t)256 * 1024);
+    const size_t size = ring.segmentSize * UPLOAD_RING_SEGMENTS;
+    glGenBuffers(1, &ring.buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring.buffer);
+    if (glExt.bufferStorage) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glExt.BufferStorage(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)size, NULL, flags);
+        ring.persistent = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)size, flags);
+    }
+    else {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)size, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void releaseDecodedImage(DecodedImage& image) {
+    std::vector<unsigned char>().swap(image.pixels);
+    std::vector<std::vector<unsigned char>>().swap(image.levels);
+    std::vector<const unsigned char*>().swap(image.levelPixels);
+    unmapFile(image.cache);
+}
+
+// нова текстура для шару (або неба, layer = -1) під час роботи: декодування у пулі, а завантаження -
+// у наступних кадрах; до того тіло показує стару або найгрубшу вже завантажену текстуру
+void streamTexture(TextureStreamer& streamer, int layer, const std::string& path) {
+    const bool sky = layer < 0;
+    if (!sky && streamer.bodies->baked) {
+        std::cout << "Body texture array is compressed, cannot stream " << path << std::endl;
+        return;
+    }
+    size_t index = submitDecode(workerPool, streamer.batch, path, sky ? 0 : streamer.bodies->width, sky ? 0 : streamer.bodies->height, true);
+    streamer.layerOfImage.resize(index + 1);
+    streamer.layerOfImage[index] = layer;
+}
+
+void beginTextureUpload(TextureStreamer& streamer, size_t index) {
+    DecodedImage& image = streamer.batch.images[index];
+    const int layer = streamer.layerOfImage[index];
+    if (image.levelPixels.empty())
+        return;
+    // новіше зображення для того самого шару витісняє недовантажене старе
+    for (auto it = streamer.uploads.begin(); it != streamer.uploads.end();) {
+        if (it->layer == layer) {
+            releaseDecodedImage(streamer.batch.images[it->image]);
+            it = streamer.uploads.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    const int levels = (int)image.levelPixels.size();
+    if (layer < 0) {
+        // розмір неба відомий лише після декодування: рівні виділяються зараз, а BASE_LEVEL
+        // опускається до кожного щойно завантаженого рівня
+        const GLenum format = pixelFormat(image.channels);
+        glBindTexture(GL_TEXTURE_2D, streamer.sky);
+        for (int level = 0; level < levels; ++level) {
+            glTexImage2D(GL_TEXTURE_2D, level, format, std::max(image.width >> level, 1), std::max(image.height >> level, 1),
+                0, format, GL_UNSIGNED_BYTE, NULL);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, levels - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    }
+    TextureUpload upload;
+    upload.image = index;
+    upload.layer = layer;
+    upload.level = levels - 1;
+    upload.row = 0;
+    streamer.uploads.push_back(upload);
+}
+
+struct PendingTextureCopy {
+    int layer;
+    int level;
+    int row;
+    int rows;
+    int width;
+    GLenum format;
+    size_t offset;
+    bool levelComplete;
+};
+
+// раз на кадр: забирає готові декодування і копіює в наступний сегмент кільця до бюджету байтів
+void pumpTextureStreaming(TextureStreamer& streamer) {
+    CPU_ZONE("pumpTextureStreaming");
+    size_t index;
+    while (pollDecode(streamer.batch, index))
+        beginTextureUpload(streamer, index);
+
+    UploadRing& ring = streamer.ring;
+    if (!streamer.uploads.empty() && ring.buffer != 0) {
+        GLsync& fence = ring.fences[ring.segment];
+        // сегмент ще читається GPU з попереднього проходу кільця: краще пропустити кадр, ніж чекати
+        if (fence && glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            return;
+        if (fence) {
+            glDeleteSync(fence);
+            fence = 0;
+        }
+
+        const size_t segmentOffset = (size_t)ring.segment * ring.segmentSize;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring.buffer);
+        unsigned char* mapped = ring.persistent ? ring.persistent + segmentOffset
+            : (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, (GLintptr)segmentOffset, (GLsizeiptr)ring.segmentSize,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (!mapped) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return;
+        }
+
+        static std::vector<PendingTextureCopy> copies;
+        copies.clear();
+        size_t used = 0;
+        while (!streamer.uploads.empty()) {
+            TextureUpload& upload = streamer.uploads.front();
+            DecodedImage& image = streamer.batch.images[upload.image];
+            const int width = std::max(image.width >> upload.level, 1);
+            const int height = std::max(image.height >> upload.level, 1);
+            const size_t rowBytes = (size_t)width * image.channels;
+            const int rows = (int)std::min((ring.segmentSize - used) / rowBytes, (size_t)(height - upload.row));
+            if (rows == 0)
+                break;
+            memcpy(mapped + used, image.levelPixels[upload.level] + upload.row * rowBytes, rows * rowBytes);
+
+            PendingTextureCopy copy;
+            copy.layer = upload.layer;
+            copy.level = upload.level;
+            copy.row = upload.row;
+            copy.rows = rows;
+            copy.width = width;
+            copy.format = pixelFormat(image.channels);
+            copy.offset = segmentOffset + used;
+            copy.levelComplete = upload.row + rows == height;
+            copies.push_back(copy);
+            used = std::min((used + rows * rowBytes + 15) & ~(size_t)15, ring.segmentSize);
+
+            upload.row += rows;
+            if (copy.levelComplete) {
+                upload.row = 0;
+                if (--upload.level < 0) {
+                    releaseDecodedImage(image);
+                    streamer.uploads.pop_front();
+                }
+            }
+        }
+        if (!ring.persistent)
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        // рядки в кільці йдуть щільно, без вирівнювання до 4 байт
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (size_t i = 0; i < copies.size(); ++i) {
+            const PendingTextureCopy& copy = copies[i];
+            if (copy.layer < 0) {
+                glBindTexture(GL_TEXTURE_2D, streamer.sky);
+                glTexSubImage2D(GL_TEXTURE_2D, copy.level, 0, copy.row, copy.width, copy.rows, copy.format, GL_UNSIGNED_BYTE, (void*)copy.offset);
+                if (copy.levelComplete)
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, copy.level);
+            }
+            else {
+                glBindTexture(GL_TEXTURE_2D_ARRAY, streamer.bodies->id);
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, copy.level, 0, copy.row, copy.layer, copy.width, copy.rows, 1,
+                    copy.format, GL_UNSIGNED_BYTE, (void*)copy.offset);
+                if (copy.levelComplete)
+                    streamer.bodies->residentLevel[copy.layer] = copy.level;
+            }
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        ring.segment = (ring.segment + 1) % UPLOAD_RING_SEGMENTS;
+        streamer.uploadedBytes += used;
+    }
+
+    if (!streamer.reported && streamer.batch.pending == 0 && streamer.uploads.empty()) {
+        streamer.reported = true;
+        double textureMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - streamer.start).count();
+        size_t cached = 0;
+        for (size_t i = 0; i < streamer.batch.images.size(); ++i)
+            cached += streamer.batch.images[i].fromCache ? 1 : 0;
+        std::cout << "Textures resident in " << textureMs << " ms (" << streamer.batch.images.size() - cached << " decoded on "
+            << workerPool.workers.size() << " threads, " << cached << " mapped from disk, " << streamer.uploadedBytes / (1024 * 1024) << " MB through PBOs)" << std::endl;
+    }
+}
+
+// стиснуті KTX2 вантажаться одразу, а jpg лише ставляться в чергу декодування: перший кадр
+// малюється відразу, з сірими тілами і темним небом, поки текстури не довантажаться
+void startTextureStreaming(TextureStreamer& streamer, TextureArray& textureArray, GLuint& skyTexture, size_t frameBudget) {
+    streamer.start = std::chrono::steady_clock::now();
+    streamer.reported = false;
+    streamer.bodies = &textureArray;
+    createUploadRing(streamer.ring, frameBudget);
+
+    if (!beginTextureArray(textureArray)) {
+        for (size_t layer = 0; layer < textureArray.layerPaths.size(); ++layer)
+            streamTexture(streamer, (int)layer, textureArray.layerPaths[layer]);
+    }
+    skyTexture = createTexture2D();
+    streamer.sky = skyTexture;
+    if (!uploadBakedTexture2D(SKY_TEXTURE_PATH)) {
+        const unsigned char placeholder[4] = { 0, 0, 0, 255 };
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        streamTexture(streamer, -1, SKY_TEXTURE_PATH);
+    }
+}
+
+// для вимірювань: довантажує все одразу, чекаючи і на воркери, і на GPU
+void finishTextureStreaming(TextureStreamer& streamer) {
+    while (streamer.batch.pending > 0 || !streamer.uploads.empty()) {
+        if (streamer.uploads.empty())
+            beginTextureUpload(streamer, waitForDecode(streamer.batch));
+        pumpTextureStreaming(streamer);
+        glFinish();
+    }
+    pumpTextureStreaming(streamer);
+}
+
+// віртуальні текстури для карт 16k-32k: --tile ріже джерело на сторінки 128x128 з рамкою в 1 піксель
+// для білінійного фільтра і пише .vt поруч з текстурою тіла. під час роботи прохід FEEDBACK у
+// зменшеному буфері показує, які сторінки бачить камера, воркери читають їх з відображеного .vt,
+// а GL-потік кладе їх у кеш фіксованого розміру і оновлює таблицю сторінок
+const int VT_TILE_SIZE = 128;
+const int VT_TILE_BORDER = 1;
+const int VT_PADDED_TILE = VT_TILE_SIZE + 2 * VT_TILE_BORDER;
+const size_t VT_TILE_BYTES = (size_t)VT_PADDED_TILE * VT_PADDED_TILE * 4;
+const int VT_MAX_PAGES_X = 256; // до 32768x16384 на рівні 0
+const int VT_MAX_PAGES_Y = 128;
+const int VT_CACHE_TILES = 32; // слотів на сторону кешу: 4160x4160 RGBA8, 66 MB незалежно від розміру карт
+const int VT_FEEDBACK_DIVISOR = 8;
+const int VT_UPLOADS_PER_FRAME = 16;
+const int VT_MAX_IN_FLIGHT = 64;
+const uint32_t VT_MAGIC = 0x54565353; // "SSVT"
+const uint32_t VT_VERSION = 1;
+
+struct VirtualTextureHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t tileSize;
+    uint32_t border;
+    uint32_t levelCount; // далі сторінки RGBA8 рівень за рівнем, у кожному рядками
+    uint32_t reserved;
+};
+
+struct VirtualTexture {
+    std::string path;
+    MappedFile file;
+    int width = 0;
+    int height = 0;
+    int levelCount = 0;
+    std::vector<size_t> firstTile; // номер першої сторінки кожного рівня у файлі
+    std::vector<std::vector<uint32_t>> pageTable; // як на GPU: слот x, слот y, рівень сторінки в слоті
+    bool pageTableDirty = true;
+};
+
+struct TileSlot {
+    uint32_t tile = 0;
+    bool used = false;
+    bool pinned = false; // найгрубший рівень не витісняється, щоб кожна сторінка мала запасного предка
+    uint32_t lastUsed = 0;
+};
+
+struct LoadedTile {
+    uint32_t tile;
+    std::vector<unsigned char> pixels;
+};
+
+struct VirtualTextureSystem {
+    std::vector<VirtualTexture> textures;
+    GLuint tileCache = 0;
+    GLuint pageTable = 0;
+    std::vector<TileSlot> slots;
+    std::unordered_map<uint32_t, int> residentTiles; // ключ сторінки -> слот
+    std::unordered_set<uint32_t> requestedTiles;     // ще читаються воркерами
+    std::mutex mutex;
+    std::deque<LoadedTile> loadedTiles;
+    GLuint feedbackFramebuffer = 0;
+    GLuint feedbackColor = 0;
+    GLuint feedbackDepth = 0;
+    int feedbackWidth = 0;
+    int feedbackHeight = 0;
+    GLuint feedbackReadback[2] = {};
+    GLsync feedbackFences[2] = {};
+    int feedbackSlot = 0;
+    uint32_t frame = 0;
+};
+VirtualTextureSystem virtualTextures;
+
+uint32_t virtualTileKey(int texture, int level, int x, int y) {
+    return (uint32_t)texture << 24 | (uint32_t)level << 16 | (uint32_t)y << 8 | (uint32_t)x;
+}
+
+int virtualPages(int size, int level) {
+    return std::max((size >> level) / VT_TILE_SIZE, 1);
+}
+
+const unsigned char* virtualTileData(const VirtualTexture& texture, int level, int x, int y) {
+    size_t tile = texture.firstTile[level] + (size_t)y * virtualPages(texture.width, level) + x;
+    return texture.file.data + sizeof(VirtualTextureHeader) + tile * VT_TILE_BYTES;
+}
+
+// ціль feedback іде за розміром кадру: зсув LOD у шейдері (-log2 VT_FEEDBACK_DIVISOR) вірний лише
+// для буфера рівно в 1/VT_FEEDBACK_DIVISOR екрана. вкладення FBO лишаються ті самі, міняється пам'ять
+void resizeVirtualTextureFeedback(VirtualTextureSystem& system) {
+    const int width = std::max(framebufferWidth / VT_FEEDBACK_DIVISOR, 1);
+    const int height = std::max(framebufferHeight / VT_FEEDBACK_DIVISOR, 1);
+    if (width == system.feedbackWidth && height == system.feedbackHeight)
+        return;
+    // прочитане в старому розмірі вже не розібрати: відкидається, наступні кадри запитають знову
+    for (int i = 0; i < 2; ++i) {
+        if (system.feedbackFences[i])
+            glDeleteSync(system.feedbackFences[i]);
+        system.feedbackFences[i] = 0;
+    }
+    system.feedbackWidth = width;
+    system.feedbackHeight = height;
+    glBindTexture(GL_TEXTURE_2D, system.feedbackColor);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindRenderbuffer(GL_RENDERBUFFER, system.feedbackDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    for (int i = 0; i < 2; ++i) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, system.feedbackReadback[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void createVirtualTextureCache(VirtualTextureSystem& system) {
+    const int cacheSize = VT_CACHE_TILES * VT_PADDED_TILE;
+    glGenTextures(1, &system.tileCache);
+    glBindTexture(GL_TEXTURE_2D, system.tileCache);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cacheSize, cacheSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    // шар на кожну віртуальну текстуру, рівень таблиці - рівень текстури
+    const int pageLevels = mipLevelCount(VT_MAX_PAGES_X, VT_MAX_PAGES_Y);
+    glGenTextures(1, &system.pageTable);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, system.pageTable);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, pageLevels - 1);
+    for (int level = 0; level < pageLevels; ++level) {
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8UI, std::max(VT_MAX_PAGES_X >> level, 1), std::max(VT_MAX_PAGES_Y >> level, 1),
+            MAX_VIRTUAL_TEXTURES, 0, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, NULL);
+    }
+    system.slots.resize(VT_CACHE_TILES * VT_CACHE_TILES);
+
+    glGenTextures(1, &system.feedbackColor);
+    glBindTexture(GL_TEXTURE_2D, system.feedbackColor);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glGenRenderbuffers(1, &system.feedbackDepth);
+    glGenBuffers(2, system.feedbackReadback);
+    resizeVirtualTextureFeedback(system);
+    glGenFramebuffers(1, &system.feedbackFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, system.feedbackFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, system.feedbackColor, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, system.feedbackDepth);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "Virtual texture feedback framebuffer is incomplete" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+}
+
+void updateVirtualTextureUniforms(const VirtualTextureSystem& system) {
+    VirtualTextureUniforms uniforms;
+    for (int i = 0; i < MAX_VIRTUAL_TEXTURES; ++i)
+        uniforms.size[i] = glm::vec4(0.0f);
+    for (size_t i = 0; i < system.textures.size(); ++i) {
+        const VirtualTexture& texture = system.textures[i];
+        uniforms.size[i] = glm::vec4((float)texture.width, (float)texture.height, (float)texture.levelCount, 0.0f);
+    }
+    uniforms.tileCacheLayout = glm::vec4((float)VT_TILE_SIZE, (float)VT_TILE_BORDER, (float)(VT_CACHE_TILES * VT_PADDED_TILE),
+        -std::log2((float)VT_FEEDBACK_DIVISOR));
+    glBindBuffer(GL_UNIFORM_BUFFER, virtualTextureUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(uniforms), &uniforms);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// вільний слот або той, що найдовше не потрібен; сторінки, видимі в останніх кадрах, не витісняються
+bool uploadVirtualTile(VirtualTextureSystem& system, uint32_t tile, const unsigned char* pixels, bool pinned) {
+    int best = -1;
+    for (size_t i = 0; i < system.slots.size(); ++i) {
+        const TileSlot& slot = system.slots[i];
+        if (!slot.used) {
+            best = (int)i;
+            break;
+        }
+        if (!slot.pinned && slot.lastUsed + 2 < system.frame && (best < 0 || slot.lastUsed < system.slots[best].lastUsed))
+            best = (int)i;
+    }
+    if (best < 0)
+        return false;
+    TileSlot& slot = system.slots[best];
+    if (slot.used) {
+        system.residentTiles.erase(slot.tile);
+        system.textures[slot.tile >> 24].pageTableDirty = true;
+    }
+    slot.tile = tile;
+    slot.used = true;
+    slot.pinned = pinned;
+    slot.lastUsed = system.frame;
+    system.residentTiles[tile] = best;
+    system.textures[tile >> 24].pageTableDirty = true;
+
+    glBindTexture(GL_TEXTURE_2D, system.tileCache);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, (best % VT_CACHE_TILES) * VT_PADDED_TILE, (best / VT_CACHE_TILES) * VT_PADDED_TILE,
+        VT_PADDED_TILE, VT_PADDED_TILE, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    return true;
+}
+
+// pictures/terra.jpg -> pictures/terra.vt; -1, якщо файлу немає або він не підходить
+int loadVirtualTexture(VirtualTextureSystem& system, const std::string& path) {
+    if (sourceAssetsOnly || (int)system.textures.size() >= MAX_VIRTUAL_TEXTURES)
+        return -1;
+    VirtualTexture texture;
+    if (!mapFile(path, texture.file))
+        return -1;
+    VirtualTextureHeader header;
+    bool valid = texture.file.size >= sizeof(header);
+    if (valid) {
+        memcpy(&header, texture.file.data, sizeof(header));
+        valid = header.magic == VT_MAGIC && header.version == VT_VERSION && header.tileSize == VT_TILE_SIZE && header.border == VT_TILE_BORDER
+            && header.width >= VT_TILE_SIZE && header.height >= VT_TILE_SIZE
+            && header.width <= VT_MAX_PAGES_X * VT_TILE_SIZE && header.height <= VT_MAX_PAGES_Y * VT_TILE_SIZE
+            && (header.width & (header.width - 1)) == 0 && (header.height & (header.height - 1)) == 0
+            && header.levelCount >= 1 && (header.width >> (header.levelCount - 1)) >= VT_TILE_SIZE && (header.height >> (header.levelCount - 1)) >= VT_TILE_SIZE;
+    }
+    size_t tileCount = 0;
+    if (valid) {
+        texture.path = path;
+        texture.width = (int)header.width;
+        texture.height = (int)header.height;
+        texture.levelCount = (int)header.levelCount;
+        for (int level = 0; level < texture.levelCount; ++level) {
+            texture.firstTile.push_back(tileCount);
+            size_t pages = (size_t)virtualPages(texture.width, level) * virtualPages(texture.height, level);
+            texture.pageTable.push_back(std::vector<uint32_t>(pages, 0));
+            tileCount += pages;
+        }
+        valid = texture.file.size == sizeof(header) + tileCount * VT_TILE_BYTES;
+    }
+    if (!valid) {
+        std::cout << "Ignoring invalid virtual texture " << path << std::endl;
+        unmapFile(texture.file);
+        return -1;
+    }
+
+    if (system.tileCache == 0)
+        createVirtualTextureCache(system);
+    const int index = (int)system.textures.size();
+    system.textures.push_back(texture);
+    const int coarsest = texture.levelCount - 1;
+    for (int y = 0; y < virtualPages(texture.height, coarsest); ++y) {
+        for (int x = 0; x < virtualPages(texture.width, coarsest); ++x)
+            uploadVirtualTile(system, virtualTileKey(index, coarsest, x, y), virtualTileData(texture, coarsest, x, y), true);
+    }
+    updateVirtualTextureUniforms(system);
+    std::cout << "Virtual texture " << path << ": " << texture.width << "x" << texture.height << ", " << texture.levelCount
+        << " levels, " << tileCount << " pages" << std::endl;
+    return index;
+}
+
+// сторінки без власного слота успадковують запис предка, тож шейдер завжди читає щось завантажене
+void uploadVirtualTexturePageTable(VirtualTextureSystem& system, int index) {
+    VirtualTexture& texture = system.textures[index];
+    glBindTexture(GL_TEXTURE_2D_ARRAY, system.pageTable);
+    for (int level = texture.levelCount - 1; level >= 0; --level) {
+        const int pagesX = virtualPages(texture.width, level);
+        const int pagesY = virtualPages(texture.height, level);
+        std::vector<uint32_t>& entries = texture.pageTable[level];
+        for (int y = 0; y < pagesY; ++y) {
+            for (int x = 0; x < pagesX; ++x) {
+                auto it = system.residentTiles.find(virtualTileKey(index, level, x, y));
+                uint32_t& entry = entries[(size_t)y * pagesX + x];
+                if (it != system.residentTiles.end()) {
+                    unsigned char packed[4] = { (unsigned char)(it->second % VT_CACHE_TILES), (unsigned char)(it->second / VT_CACHE_TILES),
+                        (unsigned char)level, 1 };
+                    memcpy(&entry, packed, sizeof(entry));
+                }
+                else if (level + 1 < texture.levelCount) {
+                    const int parentPagesX = virtualPages(texture.width, level + 1);
+                    entry = texture.pageTable[level + 1][(size_t)(y / 2) * parentPagesX + x / 2];
+                }
+            }
+        }
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, index, pagesX, pagesY, 1, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, entries.data());
+    }
+    texture.pageTableDirty = false;
+}
+
+void requestVirtualTile(VirtualTextureSystem& system, uint32_t tile) {
+    if (system.residentTiles.count(tile) || system.requestedTiles.count(tile) || (int)system.requestedTiles.size() >= VT_MAX_IN_FLIGHT)
+        return;
+    const VirtualTexture& texture = system.textures[tile >> 24];
+    const unsigned char* data = virtualTileData(texture, (tile >> 16) & 0xFF, tile & 0xFF, (tile >> 8) & 0xFF);
+    system.requestedTiles.insert(tile);
+    // копія у воркері: читання з диска (page fault відображеного файлу) відбувається не на GL-потоці
+    submitTask(workerPool, [&system, tile, data]() {
+        LoadedTile loaded;
+        loaded.tile = tile;
+        loaded.pixels.assign(data, data + VT_TILE_BYTES);
+        std::lock_guard<std::mutex> lock(system.mutex);
+        system.loadedTiles.push_back(std::move(loaded));
+    });
+}
+
+// пікселі буфера FEEDBACK: r, g - сторінка, b - текстура * 16 + рівень, a = 255 - сторінка потрібна
+void processVirtualTextureFeedback(VirtualTextureSystem& system, const unsigned char* pixels, size_t pixelCount) {
+    static std::vector<uint32_t> needed;
+    needed.clear();
+    uint32_t previous = 0xFFFFFFFFu;
+    for (size_t i = 0; i < pixelCount; ++i) {
+        const unsigned char* pixel = pixels + i * 4;
+        if (pixel[3] != 255)
+            continue;
+        int texture = pixel[2] >> 4;
+        int level = pixel[2] & 15;
+        if (texture >= (int)system.textures.size() || level >= system.textures[texture].levelCount)
+            continue;
+        uint32_t tile = virtualTileKey(texture, level, pixel[0], pixel[1]);
+        if (tile != previous)
+            needed.push_back(tile);
+        previous = tile;
+    }
+    std::sort(needed.begin(), needed.end());
+    needed.erase(std::unique(needed.begin(), needed.end()), needed.end());
+    // спершу грубші рівні: вони швидше прибирають розмиття на всій видимій частині
+    std::stable_sort(needed.begin(), needed.end(), [](uint32_t a, uint32_t b) { return ((a >> 16) & 0xFF) > ((b >> 16) & 0xFF); });
+    for (size_t i = 0; i < needed.size(); ++i) {
+        uint32_t tile = needed[i];
+        // потрібна сторінка і її предки лишаються в кеші
+        while (true) {
+            auto it = system.residentTiles.find(tile);
+            if (it != system.residentTiles.end())
+                system.slots[it->second].lastUsed = system.frame;
+            else
+                requestVirtualTile(system, tile);
+            int level = (tile >> 16) & 0xFF;
+            if (level + 1 >= system.textures[tile >> 24].levelCount)
+                break;
+            tile = virtualTileKey(tile >> 24, level + 1, (tile & 0xFF) / 2, ((tile >> 8) & 0xFF) / 2);
+        }
+    }
+}
+
+// раз на кадр: розбирає прочитаний без очікування feedback, кладе готові сторінки в кеш
+void updateVirtualTextures(VirtualTextureSystem& system) {
+    CPU_ZONE("updateVirtualTextures");
+    if (system.textures.empty())
+        return;
+    ++system.frame;
+    resizeVirtualTextureFeedback(system);
+    for (int i = 0; i < 2; ++i) {
+        GLsync& fence = system.feedbackFences[i];
+        if (!fence || glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            continue;
+        glDeleteSync(fence);
+        fence = 0;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, system.feedbackReadback[i]);
+        const size_t pixelCount = (size_t)system.feedbackWidth * system.feedbackHeight;
+        const unsigned char* pixels = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)(pixelCount * 4), GL_MAP_READ_BIT);
+        if (pixels) {
+            processVirtualTextureFeedback(system, pixels, pixelCount);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    std::deque<LoadedTile> loaded;
+    {
+        std::lock_guard<std::mutex> lock(system.mutex);
+        while (!system.loadedTiles.empty() && (int)loaded.size() < VT_UPLOADS_PER_FRAME) {
+            loaded.push_back(std::move(system.loadedTiles.front()));
+            system.loadedTiles.pop_front();
+        }
+    }
+    for (size_t i = 0; i < loaded.size(); ++i) {
+        system.requestedTiles.erase(loaded[i].tile);
+        uploadVirtualTile(system, loaded[i].tile, loaded[i].pixels.data(), false);
+    }
+    for (size_t i = 0; i < system.textures.size(); ++i) {
+        if (system.textures[i].pageTableDirty)
+            uploadVirtualTexturePageTable(system, (int)i);
+    }
+}
+
+// false - віртуальних текстур немає або обидва буфери читання ще зайняті
+bool virtualTextureFeedbackReady(const VirtualTextureSystem& system) {
+    return !system.textures.empty() && !system.feedbackFences[system.feedbackSlot];
+}
+
+// прохід FEEDBACK іде в той самий кадр, що й основний, у буфер 1/VT_FEEDBACK_DIVISOR екрана
+bool beginVirtualTextureFeedback(VirtualTextureSystem& system) {
+    if (!virtualTextureFeedbackReady(system))
+        return false;
+    glBindFramebuffer(GL_FRAMEBUFFER, system.feedbackFramebuffer);
+    glViewport(0, 0, system.feedbackWidth, system.feedbackHeight);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    return true;
+}
+
+void endVirtualTextureFeedback(VirtualTextureSystem& system, const GLint* viewport) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, system.feedbackReadback[system.feedbackSlot]);
+    glReadPixels(0, 0, system.feedbackWidth, system.feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    system.feedbackFences[system.feedbackSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    system.feedbackSlot ^= 1;
+    glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+void bindVirtualTextures(const VirtualTextureSystem& system) {
+    if (system.textures.empty())
+        return;
+    glActiveTexture(GL_TEXTURE0 + PAGE_TABLE_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, system.pageTable);
+    glActiveTexture(GL_TEXTURE0 + TILE_CACHE_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, system.tileCache);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+int nearestPowerOfTwo(int value) {
+    int power = 1;
+    while (power * 2 <= value)
+        power *= 2;
+    return (value - power > power * 2 - value) ? power * 2 : power;
+}
+
+// --tile: джерело перемасштабовується до степенів двійки, рівні йдуть до найменшого, де обидві
+// сторони ще не менші за сторінку. джерело декодується цілком, тож це офлайн-крок
+int tileVirtualTexture(const std::string& sourcePath, const std::string& texturePath) {
+    int sourceWidth, sourceHeight, channels;
+    stbi_set_flip_vertically_on_load_thread(1);
+    unsigned char* data = stbi_load(sourcePath.c_str(), &sourceWidth, &sourceHeight, &channels, 4);
+    if (!data) {
+        std::cout << "Not found: " + sourcePath + "\n" << std::flush;
+        return 1;
+    }
+    int width = std::min(std::max(nearestPowerOfTwo(sourceWidth), VT_TILE_SIZE), VT_MAX_PAGES_X * VT_TILE_SIZE);
+    int height = std::min(std::max(nearestPowerOfTwo(sourceHeight), VT_TILE_SIZE), VT_MAX_PAGES_Y * VT_TILE_SIZE);
+    std::vector<unsigned char> level((size_t)width * height * 4);
+    if (width == sourceWidth && height == sourceHeight)
+        std::copy(data, data + level.size(), level.begin());
+    else
+        resampleImage(data, sourceWidth, sourceHeight, level.data(), width, height);
+    stbi_image_free(data);
+
+    uint32_t levelCount = 1;
+    while ((width >> levelCount) >= VT_TILE_SIZE && (height >> levelCount) >= VT_TILE_SIZE)
+        ++levelCount;
+    std::string path = replaceExtension(texturePath, ".vt");
+    std::string temporaryPath = path + ".tmp";
+    FILE* file = fopen(temporaryPath.c_str(), "wb");
+    if (!file) {
+        std::cout << "Failed to write " + temporaryPath + "\n" << std::flush;
+        return 1;
+    }
+    VirtualTextureHeader header = { VT_MAGIC, VT_VERSION, (uint32_t)width, (uint32_t)height, VT_TILE_SIZE, VT_TILE_BORDER, levelCount, 0 };
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    std::vector<unsigned char> tile(VT_TILE_BYTES);
+    size_t tileCount = 0;
+    int levelWidth = width, levelHeight = height;
+    for (uint32_t levelIndex = 0; written && levelIndex < levelCount; ++levelIndex) {
+        for (int pageY = 0; written && pageY < levelHeight / VT_TILE_SIZE; ++pageY) {
+            for (int pageX = 0; written && pageX < levelWidth / VT_TILE_SIZE; ++pageX) {
+                // рамка: по горизонталі карта замкнена, по вертикалі - повтор крайнього рядка
+                for (int y = 0; y < VT_PADDED_TILE; ++y) {
+                    int sourceY = std::min(std::max(pageY * VT_TILE_SIZE + y - VT_TILE_BORDER, 0), levelHeight - 1);
+                    for (int x = 0; x < VT_PADDED_TILE; ++x) {
+                        int sourceX = (pageX * VT_TILE_SIZE + x - VT_TILE_BORDER + levelWidth) % levelWidth;
+                        memcpy(&tile[((size_t)y * VT_PADDED_TILE + x) * 4], &level[((size_t)sourceY * levelWidth + sourceX) * 4], 4);
+                    }
+                }
+                written = fwrite(tile.data(), 1, tile.size(), file) == tile.size();
+                ++tileCount;
+            }
+        }
+        std::vector<unsigned char> next;
+        downsampleHalf(level.data(), levelWidth, levelHeight, 4, next);
+        level.swap(next);
+        levelWidth /= 2;
+        levelHeight /= 2;
+    }
+    written = fclose(file) == 0 && written;
+    remove(path.c_str());
+    if (!written || rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        remove(temporaryPath.c_str());
+        std::cout << "Failed to write " + path + "\n" << std::flush;
+        return 1;
+    }
+    std::cout << "Tiled " << sourcePath << " into " << path << ": " << width << "x" << height << ", " << levelCount << " levels, "
+        << tileCount << " pages (" << tileCount * VT_TILE_BYTES / (1024 * 1024) << " MB)" << std::endl;
+    return 0;
+}
+
+// --- baker: блочні кодери 4x4 і запис KTX2 ---
+
+// головна вісь кольорів блоку (степеневий метод) і крайні проекції на неї
+void principalAxisEndpoints(const float pixels[16][4], int channels, float low[4], float high[4]) {
+    float mean[4] = { 0, 0, 0, 0 };
+    float minimum[4] = { 255, 255, 255, 255 };
+    float maximum[4] = { 0, 0, 0, 0 };
+    for (int i = 0; i < 16; ++i) {
+        for (int c = 0; c < channels; ++c) {
+            mean[c] += pixels[i][c] / 16.0f;
+            minimum[c] = std::min(minimum[c], pixels[i][c]);
+            maximum[c] = std::max(maximum[c], pixels[i][c]);
+        }
+    }
+    float covariance[4][4] = {};
+    for (int i = 0; i < 16; ++i) {
+        for (int a = 0; a < channels; ++a) {
+            for (int b = 0; b < channels; ++b)
+                covariance[a][b] += (pixels[i][a] - mean[a]) * (pixels[i][b] - mean[b]);
+        }
+    }
+    float axis[4] = { 0, 0, 0, 0 };
+    for (int c = 0; c < channels; ++c)
+        axis[c] = maximum[c] - minimum[c];
+    for (int iteration = 0; iteration < 8; ++iteration) {
+        float next[4] = { 0, 0, 0, 0 };
+        float length = 0.0f;
+        for (int a = 0; a < channels; ++a) {
+            for (int b = 0; b < channels; ++b)
+                next[a] += covariance[a][b] * axis[b];
+            length += next[a] * next[a];
+        }
+        if (length < 1e-12f)
+            break;
+        length = sqrtf(length);
+        for (int c = 0; c < channels; ++c)
+            axis[c] = next[c] / length;
+    }
+
+    float axisLength = 0.0f;
+    for (int c = 0; c < channels; ++c)
+        axisLength += axis[c] * axis[c];
+    if (axisLength < 1e-12f) {
+        for (int c = 0; c < channels; ++c)
+            low[c] = high[c] = mean[c];
+        return;
+    }
+    float tMin = 1e30f, tMax = -1e30f;
+    for (int i = 0; i < 16; ++i) {
+        float t = 0.0f;
+        for (int c = 0; c < channels; ++c)
+            t += (pixels[i][c] - mean[c]) * axis[c];
+        tMin = std::min(tMin, t);
+        tMax = std::max(tMax, t);
+    }
+    for (int c = 0; c < channels; ++c) {
+        low[c] = std::max(0.0f, std::min(255.0f, mean[c] + tMin * axis[c] / axisLength));
+        high[c] = std::max(0.0f, std::min(255.0f, mean[c] + tMax * axis[c] / axisLength));
+    }
+}
+
+void encodeBC1Block(const float pixels[16][4], unsigned char* block) {
+    float low[4], high[4];
+    principalAxisEndpoints(pixels, 3, low, high);
+    uint16_t color0 = (uint16_t)(((int)(high[0] * 31.0f / 255.0f + 0.5f) << 11) | ((int)(high[1] * 63.0f / 255.0f + 0.5f) << 5) | (int)(high[2] * 31.0f / 255.0f + 0.5f));
+    uint16_t color1 = (uint16_t)(((int)(low[0] * 31.0f / 255.0f + 0.5f) << 11) | ((int)(low[1] * 63.0f / 255.0f + 0.5f) << 5) | (int)(low[2] * 31.0f / 255.0f + 0.5f));
+    // color0 > color1 вмикає чотириколірний режим
+    if (color0 < color1)
+        std::swap(color0, color1);
+
+    float palette[4][3];
+    uint16_t endpoints[2] = { color0, color1 };
+    for (int e = 0; e < 2; ++e) {
+        int r = (endpoints[e] >> 11) & 31, g = (endpoints[e] >> 5) & 63, b = endpoints[e] & 31;
+        palette[e][0] = (float)((r << 3) | (r >> 2));
+        palette[e][1] = (float)((g << 2) | (g >> 4));
+        palette[e][2] = (float)((b << 3) | (b >> 2));
+    }
+    for (int c = 0; c < 3; ++c) {
+        palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+        palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+
+    uint32_t indices = 0;
+    if (color0 != color1) {
+        for (int i = 0; i < 16; ++i) {
+            int best = 0;
+            float bestError = 1e30f;
+            for (int p = 0; p < 4; ++p) {
+                float error = 0.0f;
+                for (int c = 0; c < 3; ++c)
+                    error += (pixels[i][c] - palette[p][c]) * (pixels[i][c] - palette[p][c]);
+                if (error < bestError) {
+                    bestError = error;
+                    best = p;
+                }
+            }
+            indices |= (uint32_t)best << (2 * i);
+        }
+    }
+    block[0] = (unsigned char)(color0 & 0xFF);
+    block[1] = (unsigned char)(color0 >> 8);
+    block[2] = (unsigned char)(color1 & 0xFF);
+    block[3] = (unsigned char)(color1 >> 8);
+    for (int i = 0; i < 4; ++i)
+        block[4 + i] = (unsigned char)(indices >> (8 * i));
+}
+
+// BC7 лише в режимі 6: одна підмножина, RGBA 7 біт + спільний p-біт, 4-бітові індекси
+void encodeBC7Block(const float pixels[16][4], unsigned char* block) {
+    static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+    float endpointsF[2][4];
+    principalAxisEndpoints(pixels, 4, endpointsF[0], endpointsF[1]);
+
+    int quantized[2][4];
+    int pBit[2];
+    for (int e = 0; e < 2; ++e) {
+        float bestError = 1e30f;
+        for (int p = 0; p < 2; ++p) {
+            int candidate[4];
+            float error = 0.0f;
+            for (int c = 0; c < 4; ++c) {
+                candidate[c] = std::max(0, std::min(127, (int)floorf((endpointsF[e][c] - p) / 2.0f + 0.5f)));
+                float value = (float)((candidate[c] << 1) | p);
+                error += (value - endpointsF[e][c]) * (value - endpointsF[e][c]);
+            }
+            if (error < bestError) {
+                bestError = error;
+                pBit[e] = p;
+                memcpy(quantized[e], candidate, sizeof(candidate));
+            }
+        }
+    }
+
+    int indices[16];
+    for (int pass = 0; pass < 2; ++pass) {
+        float palette[16][4];
+        for (int w = 0; w < 16; ++w) {
+            for (int c = 0; c < 4; ++c) {
+                int e0 = (quantized[0][c] << 1) | pBit[0];
+                int e1 = (quantized[1][c] << 1) | pBit[1];
+                palette[w][c] = (float)(((64 - weights[w]) * e0 + weights[w] * e1 + 32) >> 6);
+            }
+        }
+        for (int i = 0; i < 16; ++i) {
+            float bestError = 1e30f;
+            for (int w = 0; w < 16; ++w) {
+                float error = 0.0f;
+                for (int c = 0; c < 4; ++c)
+                    error += (pixels[i][c] - palette[w][c]) * (pixels[i][c] - palette[w][c]);
+                if (error < bestError) {
+                    bestError = error;
+                    indices[i] = w;
+                }
+            }
+        }
+        // старший біт індексу першого пікселя не зберігається, тож він мусить бути < 8
+        if (indices[0] < 8)
+            break;
+        std::swap(quantized[0], quantized[1]);
+        std::swap(pBit[0], pBit[1]);
+    }
+
+    memset(block, 0, 16);
+    int bit = 0;
+    auto put = [&](uint32_t value, int count) {
+        for (int i = 0; i < count; ++i, ++bit) {
+            if ((value >> i) & 1)
+                block[bit >> 3] |= (unsigned char)(1 << (bit & 7));
+        }
+    };
+    put(1u << 6, 7);
+    for (int c = 0; c < 4; ++c) {
+        put((uint32_t)quantized[0][c], 7);
+        put((uint32_t)quantized[1][c], 7);
+    }
+    put((uint32_t)pBit[0], 1);
+    put((uint32_t)pBit[1], 1);
+    put((uint32_t)indices[0], 3);
+    for (int i = 1; i < 16; ++i)
+        put((uint32_t)indices[i], 4);
+}
+
+// ETC2 RGB у сумісних з ETC1 режимах (individual/differential), пікселі по стовпцях
+void encodeETC2Block(const float pixels[16][4], unsigned char* block) {
+    static const int modifierTable[8][2] = { { 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 }, { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 } };
+    static const int modifierSign[4] = { 1, 1, -1, -1 };
+    static const int modifierLarge[4] = { 0, 1, 0, 1 };
+
+    float bestTotal = 1e30f;
+    uint32_t bestHigh = 0, bestLow = 0;
+    for (int flip = 0; flip < 2; ++flip) {
+        float average[2][3] = {};
+        for (int y = 0; y < 4; ++y) {
+            for (int x = 0; x < 4; ++x) {
+                int sub = flip ? (y >= 2) : (x >= 2);
+                for (int c = 0; c < 3; ++c)
+                    average[sub][c] += pixels[y * 4 + x][c] / 8.0f;
+            }
+        }
+
+        int base5[2][3], base4[2][3];
+        bool differential = true;
+        for (int c = 0; c < 3; ++c) {
+            for (int sub = 0; sub < 2; ++sub) {
+                base5[sub][c] = std::min(31, (int)(average[sub][c] * 31.0f / 255.0f + 0.5f));
+                base4[sub][c] = std::min(15, (int)(average[sub][c] * 15.0f / 255.0f + 0.5f));
+            }
+            int delta = base5[1][c] - base5[0][c];
+            differential = differential && delta >= -4 && delta <= 3;
+        }
+        int base[2][3];
+        for (int sub = 0; sub < 2; ++sub) {
+            for (int c = 0; c < 3; ++c)
+                base[sub][c] = differential ? ((base5[sub][c] << 3) | (base5[sub][c] >> 2)) : base4[sub][c] * 17;
+        }
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+        float total = 0.0f;
+        int table[2] = { 0, 0 };
+        uint32_t pixelBits = 0;
+        for (int sub = 0; sub < 2; ++sub) {
+            float bestSubError = 1e30f;
+            uint32_t bestSubBits = 0;
+            for (int t = 0; t < 8; ++t) {
+                float subError = 0.0f;
+                uint32_t subBits = 0;
+                for (int y = 0; y < 4; ++y) {
+                    for (int x = 0; x < 4; ++x) {
+                        if ((flip ? (y >= 2) : (x >= 2)) != (sub == 1))
+                            continue;
+                        float bestError = 1e30f;
+                        int bestIndex = 0;
+                        for (int m = 0; m < 4; ++m) {
+                            int modifier = modifierSign[m] * modifierTable[t][modifierLarge[m]];
+                            float error = 0.0f;
+                            for (int c = 0; c < 3; ++c) {
+                                float value = (float)std::max(0, std::min(255, base[sub][c] + modifier));
+                                error += (pixels[y * 4 + x][c] - value) * (pixels[y * 4 + x][c] - value);
+                            }
+                            if (error < bestError) {
+                                bestError = error;
+                                bestIndex = m;
+                            }
+                        }
+                        subError += bestError;
+                        int position = x * 4 + y;
+                        subBits |= (uint32_t)(bestIndex & 1) << position;
+                        subBits |= (uint32_t)(bestIndex >> 1) << (position + 16);
+                    }
+                }
+                if (subError < bestSubError) {
+                    bestSubError = subError;
+                    bestSubBits = subBits;
+                    table[sub] = t;
+                }
+            }
+            total += bestSubError;
+            pixelBits |= bestSubBits;
+        }
 
-void main() {
-   vec4 worldPosition = model * vec4(aPos, 1.0);
-    FragPos = vec3(worldPosition); 
-    Normal = mat3(transpose(inverse(model))) * aNormal; 
-    TexCoord = aTexCoord; 
-    gl_Position = projection * view * worldPosition; 
+        if (total < bestTotal) {
+            bestTotal = total;
+            uint32_t high = 0;
+            for (int c = 0; c < 3; ++c) {
+                int shift = 24 - 8 * c;
+                if (differential)
+                    high |= ((uint32_t)base5[0][c] << (shift + 3)) | ((uint32_t)((base5[1][c] - base5[0][c]) & 7) << shift);
+                else
+                    high |= ((uint32_t)base4[0][c] << (shift + 4)) | ((uint32_t)base4[1][c] << shift);
+            }
+            high |= (uint32_t)table[0] << 5 | (uint32_t)table[1] << 2 | (differential ? 2u : 0u) | (uint32_t)flip;
+            bestHigh = high;
+            bestLow = pixelBits;
+        }
+    }
+    for (int i = 0; i < 4; ++i) {
+        block[i] = (unsigned char)(bestHigh >> (24 - 8 * i));
+        block[4 + i] = (unsigned char)(bestLow >> (24 - 8 * i));
+    }
 }
-)";
-
-const char* fragmentShaderSource = R"(
-#version 330 core
-struct Material {
-    sampler2D texture_diffuse;
-    vec3 specular;
-    float shininess;
-    vec3 emission;
-};
 
-struct Light {
-    vec3 position;
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
+// RGBA8 -> блоки 4x4; неповні блоки на краях доповнюються повтором крайніх пікселів
+std::vector<unsigned char> compressImage(const unsigned char* rgba, int width, int height, int codec) {
+    const TextureCodecInfo& info = textureCodecs[codec];
+    int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    std::vector<unsigned char> blocks((size_t)blocksX * blocksY * info.blockBytes);
+    float pixels[16][4];
+    for (int by = 0; by < blocksY; ++by) {
+        for (int bx = 0; bx < blocksX; ++bx) {
+            for (int y = 0; y < 4; ++y) {
+                for (int x = 0; x < 4; ++x) {
+                    int sx = std::min(bx * 4 + x, width - 1), sy = std::min(by * 4 + y, height - 1);
+                    for (int c = 0; c < 4; ++c)
+                        pixels[y * 4 + x][c] = rgba[((size_t)sy * width + sx) * 4 + c];
+                }
+            }
+            unsigned char* block = &blocks[((size_t)by * blocksX + bx) * info.blockBytes];
+            if (codec == TEXTURE_CODEC_BC1)
+                encodeBC1Block(pixels, block);
+            else if (codec == TEXTURE_CODEC_BC7)
+                encodeBC7Block(pixels, block);
+            else
+                encodeETC2Block(pixels, block);
+        }
+    }
+    return blocks;
+}
 
-in vec2 TexCoord;
-in vec3 FragPos;
-in vec3 Normal;
+bool writeKtx2(const std::string& path, const CompressedImage& image) {
+    const TextureCodecInfo& info = textureCodecs[image.codec];
+    uint32_t levelCount = (uint32_t)image.levels.size();
 
-out vec4 FragColor;
+    // Data Format Descriptor: один базовий блок з одним семплом на весь стиснутий блок
+    uint32_t dfd[11] = {
+        44,
+        0,
+        2u | (40u << 16),
+        (uint32_t)info.dfdColorModel | (1u << 8) | (1u << 16),
+        3u | (3u << 8),
+        info.blockBytes,
+        0,
+        (info.blockBytes * 8 - 1) << 16 | (uint32_t)info.dfdChannel << 24,
+        0,
+        0,
+        0xFFFFFFFFu,
+    };
+    uint32_t dfdOffset = 80 + 24 * levelCount;
+    uint32_t dfdLength = sizeof(dfd);
 
-uniform vec3 viewPos;
-uniform Material material;
-uniform Light light;
-uniform int isSkybox; 
+    // рівні пишуться від найменшого, кожен вирівняний на розмір блоку
+    std::vector<uint64_t> levelOffsets(levelCount);
+    uint64_t offset = dfdOffset + dfdLength;
+    for (uint32_t level = levelCount; level-- > 0;) {
+        offset = (offset + info.blockBytes - 1) / info.blockBytes * info.blockBytes;
+        levelOffsets[level] = offset;
+        offset += image.levels[level].size();
+    }
 
-void main() {
-    if (isSkybox == 1) {
-        vec3 color = texture(material.texture_diffuse, TexCoord).rgb;
-        FragColor = vec4(color, 1.0);
-    } else {
-        vec3 diffuseMap = texture(material.texture_diffuse, TexCoord).rgb;
-        vec3 ambient = light.ambient * diffuseMap;
-        vec3 norm = normalize(Normal);
-        vec3 lightDir = normalize(light.position - FragPos);
-        float diff = max(dot(norm, lightDir), 0.0);
-        vec3 diffuse = light.diffuse * diff * diffuseMap;
-        vec3 viewDir = normalize(viewPos - FragPos);
-        vec3 reflectDir = reflect(-lightDir, norm);
-        float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-        vec3 specular = light.specular * (spec * material.specular);
-        vec3 emission = material.emission * diffuseMap;
-        vec3 result = ambient + diffuse + specular + emission;
-        FragColor = vec4(result, 1.0);
+    std::vector<unsigned char> bytes((size_t)offset, 0);
+    auto writeU32 = [&](size_t at, uint32_t value) { memcpy(&bytes[at], &value, sizeof(value)); };
+    auto writeU64 = [&](size_t at, uint64_t value) { memcpy(&bytes[at], &value, sizeof(value)); };
+    memcpy(bytes.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+    writeU32(12, info.vkFormat);
+    writeU32(16, 1);
+    writeU32(20, (uint32_t)image.width);
+    writeU32(24, (uint32_t)image.height);
+    writeU32(36, 1);
+    writeU32(40, levelCount);
+    writeU32(48, dfdOffset);
+    writeU32(52, dfdLength);
+    for (uint32_t level = 0; level < levelCount; ++level) {
+        writeU64(80 + 24 * level, levelOffsets[level]);
+        writeU64(80 + 24 * level + 8, image.levels[level].size());
+        writeU64(80 + 24 * level + 16, image.levels[level].size());
+        memcpy(&bytes[(size_t)levelOffsets[level]], image.levels[level].data(), image.levels[level].size());
     }
-}
-)";
+    memcpy(&bytes[dfdOffset], dfd, sizeof(dfd));
 
-GLuint loadTexture(const std::string& texturePath){
-    GLuint textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    fclose(file);
+    return written;
+}
 
+// targetWidth/targetHeight == 0 - зберегти розмір оригіналу
+bool bakeTexture(const std::string& texturePath, int targetWidth, int targetHeight, int codec) {
     int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(true);
-    unsigned char* data = stbi_load(texturePath.c_str(), &width, &height, &nrChannels, 0);
-    if (data){
-        GLenum format;
-        if (nrChannels == 1)
-            format = GL_RED;
-        else if (nrChannels == 3)
-            format = GL_RGB;
-        else if (nrChannels == 4)
-            format = GL_RGBA;
-
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else {
-        std::cout << "Not found: " << texturePath << std::endl;
+    stbi_set_flip_vertically_on_load_thread(1);
+    unsigned char* data = stbi_load(texturePath.c_str(), &width, &height, &nrChannels, 4);
+    if (!data) {
+        std::cout << "Not found: " + texturePath + "\n" << std::flush;
+        return false;
     }
+    CompressedImage image;
+    image.codec = codec;
+    image.width = targetWidth > 0 ? targetWidth : width;
+    image.height = targetHeight > 0 ? targetHeight : height;
+    std::vector<unsigned char> level((size_t)image.width * image.height * 4);
+    if (image.width == width && image.height == height)
+        std::copy(data, data + level.size(), level.begin());
+    else
+        resampleImage(data, width, height, level.data(), image.width, image.height);
     stbi_image_free(data);
-    return textureID;
+
+    int levelWidth = image.width, levelHeight = image.height;
+    while (true) {
+        image.levels.push_back(compressImage(level.data(), levelWidth, levelHeight, codec));
+        if (levelWidth == 1 && levelHeight == 1)
+            break;
+        int nextWidth = std::max(levelWidth / 2, 1), nextHeight = std::max(levelHeight / 2, 1);
+        std::vector<unsigned char> next((size_t)nextWidth * nextHeight * 4);
+        resampleImage(level.data(), levelWidth, levelHeight, next.data(), nextWidth, nextHeight);
+        level.swap(next);
+        levelWidth = nextWidth;
+        levelHeight = nextHeight;
+    }
+
+    std::string bakedPath = bakedTexturePath(texturePath);
+    if (!writeKtx2(bakedPath, image)) {
+        std::cout << "Failed to write " + bakedPath + "\n" << std::flush;
+        return false;
+    }
+    size_t bytes = 0;
+    for (size_t i = 0; i < image.levels.size(); ++i)
+        bytes += image.levels[i].size();
+    // рядок складається цілком, щоб виводи з різних воркерів не перемішувались
+    char message[512];
+    snprintf(message, sizeof(message), "Baked %s: %dx%d %s, %d levels, %d KB\n", bakedPath.c_str(), image.width, image.height,
+        textureCodecs[codec].name, (int)image.levels.size(), (int)(bytes / 1024));
+    std::cout << message << std::flush;
+    return true;
+}
+
+// тіла печуться одразу в розмір масиву текстур, небо - у власному розмірі
+int bakeTextures(const TextureArray& textureArray, int codec) {
+    std::vector<std::string> paths = textureArray.layerPaths;
+    paths.push_back(SKY_TEXTURE_PATH);
+    std::mutex mutex;
+    std::condition_variable done;
+    int remaining = (int)paths.size();
+    int failed = 0;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        bool ownSize = paths[i] == SKY_TEXTURE_PATH;
+        int width = ownSize ? 0 : textureArray.width;
+        int height = ownSize ? 0 : textureArray.height;
+        std::string path = paths[i];
+        submitTask(workerPool, [&, path, width, height]() {
+            bool baked = bakeTexture(path, width, height, codec);
+            std::lock_guard<std::mutex> lock(mutex);
+            failed += baked ? 0 : 1;
+            if (--remaining == 0)
+                done.notify_one();
+        });
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&]() { return remaining == 0; });
+    return failed;
 }
 
 void generateSphere(std::vector<float>& vertices, std::vector<unsigned int>& indices, float radius, unsigned int sectorCount, unsigned int stackCount, bool ifNotSky){
+    CPU_ZONE("generateSphere");
     float x, y, z, xy;                             
     float nx, ny, nz, lengthInv = 1.0f / radius;    
     float s, t;                                     
@@ -237,81 +3310,639 @@ void generateSphere(std::vector<float>& vertices, std::vector<unsigned int>& ind
         }
     }
 }
-void drawSkySphere(GLuint shaderProgram, glm::mat4 view, glm::mat4 projection) {
-    static GLuint VAO = 0, VBO = 0, EBO = 0;
-    static size_t indexCount = 0;
+// небо малюється останнім одним трикутником на весь екран на дальній площині: фрагменти,
+// закриті тілами, відкидає тест глибини, а колір береться з bg.jpeg за напрямком погляду
+void drawSky(const SceneProgram& scene) {
+    CPU_ZONE("drawSky");
+    GpuProfileScope profileScope(permutationNames[PERMUTATION_SKY]);
+    static GLuint VAO = 0;
     static bool initialized = false;
 
     if (!initialized) {
-        std::vector<float> vertices;
-        std::vector<unsigned int> indices;
-        float radius = 20.0f; 
-        generateSphere(vertices, indices, radius, 36, 18, false);
-        skyIndexCount = indices.size();
+        // вершини будуються з gl_VertexID, але core profile вимагає прив'язаний VAO
         glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
-
-        glBindVertexArray(VAO);
-
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
-        int stride = (3 + 2 + 3) * sizeof(float);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
-        glEnableVertexAttribArray(0);
-
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
-        glEnableVertexAttribArray(1);
-
-        glBindVertexArray(0);
-        skyTextureID = loadTexture("D:/vscode_asd_laz/test_shaders/pictures/bg.jpeg");
         initialized = true;
     }
 
     glDepthMask(GL_FALSE);
+    glDepthFunc(GL_LEQUAL);
 
-    glUseProgram(shaderProgram);
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-    glm::mat4 model = glm::translate(glm::mat4(1.0f), cameraPos);
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    glUseProgram(scene.program.id);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, skyTextureID);
-    glUniform1i(glGetUniformLocation(shaderProgram, "material.texture_diffuse"), 0);
-    glUniform1i(glGetUniformLocation(shaderProgram, "isSkybox"), 1);
 
     glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(skyIndexCount), GL_UNSIGNED_INT, 0);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
     glBindVertexArray(0);
+    glDepthFunc(GL_LESS);
     glDepthMask(GL_TRUE);
 }
-void drawCelestialBody(GLuint shaderProgram, glm::mat4 view, glm::mat4 projection, glm::vec3 viewPos, const CelestialBody& celestialBody, glm::mat4 parentModel = glm::mat4(1.0f)) {
-    static std::unordered_map<float, GLuint> vaoMap;
-    static std::unordered_map<float, GLuint> vboMap;
-    static std::unordered_map<float, GLuint> eboMap;
-    static std::unordered_map<float, size_t> indexCountMap;
+// той самий генератор на всіх платформах (розподіли std:: залежать від реалізації), тож пояс
+// астероїдів і початкові умови N-тіл однакові в кожному запуску й на кожній машині
+uint64_t splitMix64(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+float randomFloat(uint64_t& state) {
+    return (float)(splitMix64(state) >> 40) / 16777216.0f;
+}
+
+// --nbody: тіла з mass > 0 рухаються під взаємним тяжінням замість кіл orbitSpeed * day.
+// одиниці сцени (відстань) і дні (час); G * M Сонця підібрано так, щоб колова орбіта на
+// радіусі Землі мала її orbitSpeed, решта періодів виходить за Кеплером
+const float NBODY_GM_SUN = glm::radians(15.8f) * glm::radians(15.8f);
+const float NBODY_SOFTENING_SQ = 1e-4f; // згладжування 0.01 одиниці: без нескінченних сил при зближенні
+const float NBODY_TIMESTEP = 0.1f;      // днів; Меркурій отримує ~100 кроків на оберт
+const int NBODY_MAX_STEPS_PER_FRAME = 4; // якщо не встигає, симуляція відстає від day, а не гальмує кадр
+const int NBODY_PADDING = 16;           // масиви кратні ширині найширшого SIMD; хвіст з нульовою масою
+const uint64_t NBODY_SEED = 0x0B0D1E5ull;
+const int NBODY_BENCH_DEFAULT_COUNT = 10000;
+
+enum NBodyKernel {
+    NBODY_KERNEL_SCALAR,
+    NBODY_KERNEL_AVX2,
+    NBODY_KERNEL_AVX512,
+    NBODY_KERNEL_COUNT
+};
+
+const char* nbodyKernelNames[NBODY_KERNEL_COUNT] = { "scalar", "avx2", "avx512" };
+
+// SIMD-ядра збираються завжди, незалежно від -m/-arch прапорців програми: GCC і Clang - через
+// target-атрибути, MSVC дозволяє інтринсики AVX у будь-якій функції. яке ядро можна запускати,
+// вирішує процесор під час роботи
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define NBODY_SIMD 1
+#define NBODY_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define NBODY_TARGET_AVX512 __attribute__((target("avx512f")))
+#elif defined(_M_X64) && defined(_MSC_VER)
+#define NBODY_SIMD 1
+#define NBODY_TARGET_AVX2
+#define NBODY_TARGET_AVX512
+#else
+#define NBODY_SIMD 0
+#endif
+
+bool nbodyKernelAvailable(int kernel) {
+    if (kernel == NBODY_KERNEL_SCALAR)
+        return true;
+#if NBODY_SIMD && defined(_MSC_VER)
+    // cpuid + xgetbv: інструкції є в процесорі, а ОС зберігає регістри ymm/zmm при перемиканні
+    int info[4];
+    __cpuid(info, 1);
+    const bool fma = (info[2] & (1 << 12)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    __cpuidex(info, 7, 0);
+    if (kernel == NBODY_KERNEL_AVX2)
+        return fma && (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+    if (kernel == NBODY_KERNEL_AVX512)
+        return (info[1] & (1 << 16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+#elif NBODY_SIMD
+    __builtin_cpu_init();
+    if (kernel == NBODY_KERNEL_AVX2)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (kernel == NBODY_KERNEL_AVX512)
+        return __builtin_cpu_supports("avx512f");
+#endif
+    return false;
+}
+
+// SoA: кожне ядро читає x, y, z, gm j-тих тіл суцільними векторами
+struct NBodySystem {
+    int count = 0;
+    int padded = 0;
+    std::vector<float> x, y, z;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> gm; // G * маса
+    std::vector<float> ax, ay, az;
+    int kernel = NBODY_KERNEL_SCALAR;
+    float simulatedDay = 0.0f;
+    bool active = false;
+};
+
+NBodySystem nbody;
+
+int addNBody(NBodySystem& system, const glm::vec3& position, const glm::vec3& velocity, float mass) {
+    system.x.push_back(position.x);
+    system.y.push_back(position.y);
+    system.z.push_back(position.z);
+    system.vx.push_back(velocity.x);
+    system.vy.push_back(velocity.y);
+    system.vz.push_back(velocity.z);
+    system.gm.push_back(mass * NBODY_GM_SUN);
+    return system.count++;
+}
+
+// хвіст до кратного NBODY_PADDING: нульова маса, тож внесок у сили нульовий без перевірок у ядрах
+void padNBodySystem(NBodySystem& system) {
+    system.padded = (system.count + NBODY_PADDING - 1) / NBODY_PADDING * NBODY_PADDING;
+    for (std::vector<float>* field : { &system.x, &system.y, &system.z, &system.vx, &system.vy, &system.vz, &system.gm })
+        field->resize(system.padded, 0.0f);
+    system.ax.assign(system.padded, 0.0f);
+    system.ay.assign(system.padded, 0.0f);
+    system.az.assign(system.padded, 0.0f);
+}
+
+// пряма сума O(N^2); самодія дає нуль, бо d = 0, а згладжування не дає ділити на нуль
+void nbodyAccelerationsScalar(NBodySystem& system) {
+    const float* x = system.x.data();
+    const float* y = system.y.data();
+    const float* z = system.z.data();
+    const float* gm = system.gm.data();
+    for (int i = 0; i < system.count; ++i) {
+        float xi = x[i], yi = y[i], zi = z[i];
+        float sumX = 0.0f, sumY = 0.0f, sumZ = 0.0f;
+        for (int j = 0; j < system.padded; ++j) {
+            float dx = x[j] - xi, dy = y[j] - yi, dz = z[j] - zi;
+            float distanceSq = dx * dx + dy * dy + dz * dz + NBODY_SOFTENING_SQ;
+            float inverse = 1.0f / sqrtf(distanceSq);
+            float strength = gm[j] * inverse * inverse * inverse;
+            sumX += dx * strength;
+            sumY += dy * strength;
+            sumZ += dz * strength;
+        }
+        system.ax[i] = sumX;
+        system.ay[i] = sumY;
+        system.az[i] = sumZ;
+    }
+}
+
+#if NBODY_SIMD
+NBODY_TARGET_AVX2 float horizontalSum256(__m256 value) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(value), _mm256_extractf128_ps(value, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+}
+
+// 8 j-тіл за раз; rsqrt (12 біт) плюс крок Ньютона дає ~22 біти, майже як 1 / sqrt
+NBODY_TARGET_AVX2 void nbodyAccelerationsAvx2(NBodySystem& system) {
+    const __m256 softening = _mm256_set1_ps(NBODY_SOFTENING_SQ);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 three = _mm256_set1_ps(3.0f);
+    for (int i = 0; i < system.count; ++i) {
+        const __m256 xi = _mm256_set1_ps(system.x[i]), yi = _mm256_set1_ps(system.y[i]), zi = _mm256_set1_ps(system.z[i]);
+        __m256 sumX = _mm256_setzero_ps(), sumY = _mm256_setzero_ps(), sumZ = _mm256_setzero_ps();
+        for (int j = 0; j < system.padded; j += 8) {
+            __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(&system.x[j]), xi);
+            __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(&system.y[j]), yi);
+            __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(&system.z[j]), zi);
+            __m256 distanceSq = _mm256_fmadd_ps(dx, dx, _mm256_fmadd_ps(dy, dy, _mm256_fmadd_ps(dz, dz, softening)));
+            __m256 inverse = _mm256_rsqrt_ps(distanceSq);
+            inverse = _mm256_mul_ps(_mm256_mul_ps(half, inverse), _mm256_sub_ps(three, _mm256_mul_ps(distanceSq, _mm256_mul_ps(inverse, inverse))));
+            __m256 strength = _mm256_mul_ps(_mm256_loadu_ps(&system.gm[j]), _mm256_mul_ps(inverse, _mm256_mul_ps(inverse, inverse)));
+            sumX = _mm256_fmadd_ps(dx, strength, sumX);
+            sumY = _mm256_fmadd_ps(dy, strength, sumY);
+            sumZ = _mm256_fmadd_ps(dz, strength, sumZ);
+        }
+        system.ax[i] = horizontalSum256(sumX);
+        system.ay[i] = horizontalSum256(sumY);
+        system.az[i] = horizontalSum256(sumZ);
+    }
+}
+
+// без _mm512_reduce_add_ps і незамаскованого rsqrt14: їхній _mm512_undefined_* дає хибні
+// -Wmaybe-uninitialized у GCC 12; сума раз на i-те тіло на швидкість не впливає
+NBODY_TARGET_AVX512 float horizontalSum512(__m512 value) {
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, value);
+    float sum = 0.0f;
+    for (int lane = 0; lane < 16; ++lane)
+        sum += lanes[lane];
+    return sum;
+}
+
+// 16 j-тіл за раз; rsqrt14 точніший за AVX2-версію, але крок Ньютона той самий
+NBODY_TARGET_AVX512 void nbodyAccelerationsAvx512(NBodySystem& system) {
+    const __m512 softening = _mm512_set1_ps(NBODY_SOFTENING_SQ);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 three = _mm512_set1_ps(3.0f);
+    for (int i = 0; i < system.count; ++i) {
+        const __m512 xi = _mm512_set1_ps(system.x[i]), yi = _mm512_set1_ps(system.y[i]), zi = _mm512_set1_ps(system.z[i]);
+        __m512 sumX = _mm512_setzero_ps(), sumY = _mm512_setzero_ps(), sumZ = _mm512_setzero_ps();
+        for (int j = 0; j < system.padded; j += 16) {
+            __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(&system.x[j]), xi);
+            __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(&system.y[j]), yi);
+            __m512 dz = _mm512_sub_ps(_mm512_loadu_ps(&system.z[j]), zi);
+            __m512 distanceSq = _mm512_fmadd_ps(dx, dx, _mm512_fmadd_ps(dy, dy, _mm512_fmadd_ps(dz, dz, softening)));
+            __m512 inverse = _mm512_maskz_rsqrt14_ps(0xFFFF, distanceSq);
+            inverse = _mm512_mul_ps(_mm512_mul_ps(half, inverse), _mm512_fnmadd_ps(distanceSq, _mm512_mul_ps(inverse, inverse), three));
+            __m512 strength = _mm512_mul_ps(_mm512_loadu_ps(&system.gm[j]), _mm512_mul_ps(inverse, _mm512_mul_ps(inverse, inverse)));
+            sumX = _mm512_fmadd_ps(dx, strength, sumX);
+            sumY = _mm512_fmadd_ps(dy, strength, sumY);
+            sumZ = _mm512_fmadd_ps(dz, strength, sumZ);
+        }
+        system.ax[i] = horizontalSum512(sumX);
+        system.ay[i] = horizontalSum512(sumY);
+        system.az[i] = horizontalSum512(sumZ);
+    }
+}
+#endif
+
+void computeNBodyAccelerations(NBodySystem& system) {
+    switch (system.kernel) {
+#if NBODY_SIMD
+    case NBODY_KERNEL_AVX512: nbodyAccelerationsAvx512(system); return;
+    case NBODY_KERNEL_AVX2: nbodyAccelerationsAvx2(system); return;
+#endif
+    default: nbodyAccelerationsScalar(system); return;
+    }
+}
+
+// leapfrog kick-drift-kick: симплектичний, тож енергія коливається, а не дрейфує;
+// прискорення з кінця кроку використовуються на початку наступного
+void stepNBody(NBodySystem& system, float dt) {
+    const float halfStep = 0.5f * dt;
+    for (int i = 0; i < system.count; ++i) {
+        system.vx[i] += system.ax[i] * halfStep;
+        system.vy[i] += system.ay[i] * halfStep;
+        system.vz[i] += system.az[i] * halfStep;
+        system.x[i] += system.vx[i] * dt;
+        system.y[i] += system.vy[i] * dt;
+        system.z[i] += system.vz[i] * dt;
+    }
+    computeNBodyAccelerations(system);
+    for (int i = 0; i < system.count; ++i) {
+        system.vx[i] += system.ax[i] * halfStep;
+        system.vy[i] += system.ay[i] * halfStep;
+        system.vz[i] += system.az[i] * halfStep;
+    }
+}
+
+// повна енергія, помножена на G (маси відомі лише як gm); лише для перевірки інтегратора
+double nbodyEnergy(const NBodySystem& system) {
+    double energy = 0.0;
+    for (int i = 0; i < system.count; ++i) {
+        double speedSq = (double)system.vx[i] * system.vx[i] + (double)system.vy[i] * system.vy[i] + (double)system.vz[i] * system.vz[i];
+        energy += 0.5 * system.gm[i] * speedSq;
+        for (int j = i + 1; j < system.count; ++j) {
+            double dx = system.x[j] - system.x[i], dy = system.y[j] - system.y[i], dz = system.z[j] - system.z[i];
+            energy -= (double)system.gm[i] * system.gm[j] / sqrt(dx * dx + dy * dy + dz * dz + NBODY_SOFTENING_SQ);
+        }
+    }
+    return energy;
+}
+
+// швидкість колової орбіти навколо Сонця в тому ж напрямку, що й orbitSpeed * day
+glm::vec3 circularOrbitVelocity(const glm::vec3& position) {
+    float radius = glm::length(glm::vec2(position.x, position.z));
+    if (radius <= 0.0f)
+        return glm::vec3(0.0f);
+    float speed = sqrtf(NBODY_GM_SUN / radius);
+    return glm::vec3(position.z, 0.0f, -position.x) / radius * speed;
+}
+
+// диск дрібних тіл між Меркурієм і Юпітером: майже колові орбіти з невеликим розкидом
+void addNBodyParticles(NBodySystem& system, int count, uint64_t seed) {
+    uint64_t random = seed;
+    for (int i = 0; i < count; ++i) {
+        float radius = 0.8f + 3.2f * randomFloat(random);
+        float angle = 2.0f * PI * randomFloat(random);
+        glm::vec3 position(radius * cosf(angle), 0.05f * (randomFloat(random) - 0.5f) * radius, -radius * sinf(angle));
+        glm::vec3 velocity = circularOrbitVelocity(position) * (0.97f + 0.06f * randomFloat(random));
+        addNBody(system, position, velocity, 1e-10f);
+    }
+}
+
+// загальний імпульс у нуль, щоб центр мас (і Сонце разом з ним) не відпливав зі сцени
+void removeNBodyDrift(NBodySystem& system) {
+    double momentumX = 0.0, momentumY = 0.0, momentumZ = 0.0, totalMass = 0.0;
+    for (int i = 0; i < system.count; ++i) {
+        momentumX += (double)system.gm[i] * system.vx[i];
+        momentumY += (double)system.gm[i] * system.vy[i];
+        momentumZ += (double)system.gm[i] * system.vz[i];
+        totalMass += system.gm[i];
+    }
+    for (int i = 0; i < system.count && totalMass > 0.0; ++i) {
+        system.vx[i] -= (float)(momentumX / totalMass);
+        system.vy[i] -= (float)(momentumY / totalMass);
+        system.vz[i] -= (float)(momentumZ / totalMass);
+    }
+}
+
+void startNBody(NBodySystem& system, int kernel) {
+    padNBodySystem(system);
+    removeNBodyDrift(system);
+    system.kernel = kernel;
+    system.simulatedDay = day; // початкові положення взято з кіл на поточний день
+    computeNBodyAccelerations(system);
+    system.active = true;
+}
+
+// наздоганяє day фіксованими кроками; час кадру вимірюється днями, тож і в --benchmark кроки ті самі
+void updateNBody(NBodySystem& system, float targetDay) {
+    if (!system.active)
+        return;
+    CPU_ZONE("updateNBody");
+    int steps = 0;
+    while (system.simulatedDay + NBODY_TIMESTEP <= targetDay && steps < NBODY_MAX_STEPS_PER_FRAME) {
+        stepNBody(system, NBODY_TIMESTEP);
+        system.simulatedDay += NBODY_TIMESTEP;
+        ++steps;
+    }
+    if (system.simulatedDay + NBODY_TIMESTEP <= targetDay)
+        system.simulatedDay = targetDay;
+}
+
+glm::vec3 nbodyPosition(const NBodySystem& system, int index) {
+    return glm::vec3(system.x[index], system.y[index], system.z[index]);
+}
+
+// --nbody-bench: ті самі початкові умови для кожного доступного ядра; час кроку, взаємодії за
+// секунду, розбіжність прискорень зі скалярним ядром і дрейф енергії за 100 кроків
+int runNBodyBenchmark(int count) {
+    NBodySystem reference;
+    addNBody(reference, glm::vec3(0.0f), glm::vec3(0.0f), 1.0f);
+    addNBodyParticles(reference, count - 1, NBODY_SEED);
+    padNBodySystem(reference);
+    removeNBodyDrift(reference);
+    nbodyAccelerationsScalar(reference);
+
+    int best = NBODY_KERNEL_SCALAR;
+    double scalarMs = 0.0;
+    for (int kernel = 0; kernel < NBODY_KERNEL_COUNT; ++kernel) {
+        if (!nbodyKernelAvailable(kernel)) {
+            printf("%-7s not supported by this CPU\n", nbodyKernelNames[kernel]);
+            continue;
+        }
+        NBodySystem system = reference;
+        system.kernel = kernel;
+        computeNBodyAccelerations(system);
+        double maxError = 0.0;
+        for (int i = 0; i < count; ++i) {
+            glm::vec3 expected(reference.ax[i], reference.ay[i], reference.az[i]);
+            glm::vec3 actual(system.ax[i], system.ay[i], system.az[i]);
+            maxError = std::max(maxError, (double)(glm::length(actual - expected) / std::max(glm::length(expected), 1e-30f)));
+        }
+        int iterations = 0;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed = 0.0;
+        while (elapsed < 0.5 || iterations < 2) {
+            computeNBodyAccelerations(system);
+            ++iterations;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        double ms = elapsed * 1000.0 / iterations;
+        scalarMs = kernel == NBODY_KERNEL_SCALAR ? ms : scalarMs;
+        best = kernel;
+        printf("%-7s %d bodies: %.3f ms/step, %.2f G interactions/s, x%.2f vs scalar, max relative error %.2e\n", nbodyKernelNames[kernel], count, ms,
+            (double)count * reference.padded / (ms * 1.0e6), scalarMs / ms, maxError);
+    }
+
+    NBodySystem system = reference;
+    system.kernel = best;
+    double energyBefore = nbodyEnergy(system);
+    for (int step = 0; step < 100; ++step)
+        stepNBody(system, NBODY_TIMESTEP);
+    double energyAfter = nbodyEnergy(system);
+    printf("leapfrog (%s), 100 steps of %.2f days: relative energy drift %.2e\n", nbodyKernelNames[best], NBODY_TIMESTEP,
+        fabs((energyAfter - energyBefore) / energyBefore));
+    return 0;
+}
+
+// положення на орбіті без нахилу осі й власного обертання; під --nbody - з симуляції
+glm::mat4 computeOrbitFrame(const CelestialBody& celestialBody, const glm::mat4& parentModel) {
+    if (nbody.active && celestialBody.simulationIndex >= 0)
+        return glm::translate(glm::mat4(1.0f), nbodyPosition(nbody, celestialBody.simulationIndex));
+    float orbitAngle = glm::radians(day * celestialBody.orbitSpeed);
+    glm::mat4 model = glm::rotate(parentModel, orbitAngle, glm::vec3(0.0f, 1.0f, 0.0f));
+    return glm::translate(model, glm::vec3(celestialBody.orbitRadius, 0.0f, 0.0f));
+}
+
+// тіло стартує з того місця, де зараз його колова орбіта, з коловою швидкістю навколо Сонця
+void registerNBody(NBodySystem& system, CelestialBody& celestialBody) {
+    glm::vec3 position = glm::vec3(computeOrbitFrame(celestialBody, glm::mat4(1.0f))[3]);
+    celestialBody.simulationIndex = addNBody(system, position, circularOrbitVelocity(position), celestialBody.mass);
+}
+
+glm::mat4 computeBodyModel(const CelestialBody& celestialBody, const glm::mat4& parentModel) {
+    glm::mat4 model = computeOrbitFrame(celestialBody, parentModel);
+
+    model = glm::rotate(model, glm::radians(celestialBody.axisTilt), glm::vec3(1.0f, 0.0f, 0.0f));
+
+    float selfRotationAngle = glm::radians(day * celestialBody.rotationSpeed * celestialBody.rotationDirection);
+    model = glm::rotate(model, selfRotationAngle, glm::vec3(0.0f, 1.0f, 0.0f));
+
+    // одна одинична сфера на всі тіла, розмір задається масштабом
+    model = glm::scale(model, glm::vec3(celestialBody.size));
+    return model;
+}
+
+// тіла складаються лише з обертань, зсувів і рівномірного масштабу, тому
+// transpose(inverse(m)) збігається з m / scale і обертати матрицю не потрібно
+glm::mat3 computeNormalMatrix(const glm::mat4& model) {
+    glm::mat3 linear(model);
+    float scaleX = glm::dot(linear[0], linear[0]);
+    float scaleY = glm::dot(linear[1], linear[1]);
+    float scaleZ = glm::dot(linear[2], linear[2]);
+    if (fabsf(scaleX - scaleY) <= 1e-4f * scaleX && fabsf(scaleX - scaleZ) <= 1e-4f * scaleX)
+        return linear * (1.0f / sqrtf(scaleX));
+    return glm::transpose(glm::inverse(linear));
+}
+
+// площини з рядків projection * view (Gribb/Hartmann), нормалізовані для відстаней у світових одиницях
+Frustum extractFrustum(const glm::mat4& viewProjection) {
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; ++i)
+        row[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+    Frustum frustum;
+    frustum.planes[0] = row[3] + row[0]; // ліва
+    frustum.planes[1] = row[3] - row[0]; // права
+    frustum.planes[2] = row[3] + row[1]; // нижня
+    frustum.planes[3] = row[3] - row[1]; // верхня
+    frustum.planes[4] = row[3] + row[2]; // ближня
+    frustum.planes[5] = row[3] - row[2]; // дальня
+    for (int i = 0; i < 6; ++i)
+        frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+    return frustum;
+}
+
+bool sphereInFrustum(const Frustum& frustum, const glm::vec3& center, float radius) {
+    for (int i = 0; i < 6; ++i) {
+        if (glm::dot(glm::vec3(frustum.planes[i]), center) + frustum.planes[i].w < -radius)
+            return false;
+    }
+    return true;
+}
+
+void beginFrameCulling(const glm::mat4& view, const glm::mat4& projection) {
+    cameraFrustum = extractFrustum(projection * view);
+    cullStats = CullStats();
+}
+
+void beginFrameLod(const glm::mat4& projection, float viewportHeight) {
+    // projection[1][1] = 1 / tan(fov / 2)
+    lodPixelScale = projection[1][1] * viewportHeight * 0.5f;
+}
+
+float projectedPixelRadius(const glm::vec3& center, float radius) {
+    glm::vec3 toCamera = center - cameraPos;
+    float distanceSq = glm::dot(toCamera, toCamera);
+    float radiusSq = radius * radius;
+    if (distanceSq <= radiusSq)
+        return 1e30f;
+    return radius / sqrtf(distanceSq - radiusSq) * lodPixelScale;
+}
+
+int selectSphereLod(float pixelRadius, int currentLevel) {
+    int level = 0;
+    while (level < SPHERE_LOD_COUNT - 1 && pixelRadius >= sphereLodLevels[level].maxPixelRadius)
+        ++level;
+    // деталізація зростає одразу, а падає лише за межею гістерезису, щоб не було мерехтіння
+    if (currentLevel > level && pixelRadius >= sphereLodLevels[currentLevel - 1].maxPixelRadius * LOD_HYSTERESIS)
+        level = currentLevel;
+    return level;
+}
+
+void drawCelestialBody(CelestialBody& celestialBody, glm::mat4 parentModel = glm::mat4(1.0f)) {
+    CPU_ZONE("drawCelestialBody");
+    glm::mat4 model = computeBodyModel(celestialBody, parentModel);
+    // обмежуюча сфера: центр - зсув моделі, радіус - size з урахуванням масштабу батьків
+    glm::vec3 center = glm::vec3(model[3]);
+    float radius = glm::length(glm::vec3(model[0]));
+    if (!sphereInFrustum(cameraFrustum, center, radius)) {
+        ++cullStats.culled;
+        return;
+    }
+    ++cullStats.visible;
+    celestialBody.lodLevel = selectSphereLod(projectedPixelRadius(center, radius), celestialBody.lodLevel);
+
+    QueuedBody queued;
+    queued.lod = celestialBody.lodLevel;
+    // тіла з власним світлом (Сонце) не потребують освітлення за Фонгом
+    bool emissive = celestialBody.material.emission != glm::vec3(0.0f);
+    queued.permutation = emissive ? PERMUTATION_EMISSIVE_ONLY : PERMUTATION_LIT;
+    if (impostorMode && glm::length(center - cameraPos) > radius * IMPOSTOR_MIN_DISTANCE) {
+        queued.permutation = emissive ? PERMUTATION_EMISSIVE_ONLY_IMPOSTOR : PERMUTATION_LIT_IMPOSTOR;
+        queued.lod = 0;
+    }
+    queued.instance.model = model;
+    queued.instance.specularShininess = glm::vec4(celestialBody.material.specular, celestialBody.material.shininess);
+    queued.instance.emissionLayer = glm::vec4(celestialBody.material.emission, (float)celestialBody.textureLayer);
+    queued.instance.normalMatrix = computeNormalMatrix(queued.instance.model);
+    queued.instance.textureMinLevel = (float)bodyTextures.residentLevel[celestialBody.textureLayer];
+    queued.instance.virtualTexture = (float)celestialBody.virtualTexture;
+    queuedBodies.push_back(queued);
+}
+
+void setBodyInstanceAttributes(size_t firstInstance) {
+    const size_t stride = sizeof(BodyInstance);
+    const size_t base = firstInstance * stride;
+    for (int column = 0; column < 4; ++column) {
+        glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, (GLsizei)stride, (void*)(base + offsetof(BodyInstance, model) + column * sizeof(glm::vec4)));
+    }
+    glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, (GLsizei)stride, (void*)(base + offsetof(BodyInstance, specularShininess)));
+    glVertexAttribPointer(8, 4, GL_FLOAT, GL_FALSE, (GLsizei)stride, (void*)(base + offsetof(BodyInstance, emissionLayer)));
+    for (int column = 0; column < 3; ++column) {
+        glVertexAttribPointer(9 + column, 3, GL_FLOAT, GL_FALSE, (GLsizei)stride, (void*)(base + offsetof(BodyInstance, normalMatrix) + column * sizeof(glm::vec3)));
+    }
+    glVertexAttribPointer(12, 1, GL_FLOAT, GL_FALSE, (GLsizei)stride, (void*)(base + offsetof(BodyInstance, textureMinLevel)));
+    glVertexAttribPointer(13, 1, GL_FLOAT, GL_FALSE, (GLsizei)stride, (void*)(base + offsetof(BodyInstance, virtualTexture)));
+}
 
-    GLuint VAO, VBO, EBO;
+struct SphereLodMesh {
+    GLint baseVertex;
+    size_t firstIndex;
     size_t indexCount;
-    if (vaoMap.find(celestialBody.size) == vaoMap.end()) {
-        std::vector<float> vertices;
-        std::vector<unsigned int> indices;
-        generateSphere(vertices, indices, celestialBody.size, 36, 18, true);
+};
+
+// усі рівні в одному наборі вершин та індексів, рівень вибирається baseVertex і зсувом індексів
+void buildSphereLods(std::vector<float>& vertices, std::vector<unsigned int>& indices, SphereLodMesh* lodMeshes) {
+    const size_t floatsPerVertex = 3 + 2 + 3;
+    for (int level = 0; level < SPHERE_LOD_COUNT; ++level) {
+        lodMeshes[level].baseVertex = (GLint)(vertices.size() / floatsPerVertex);
+        lodMeshes[level].firstIndex = indices.size();
+        generateSphere(vertices, indices, 1.0f, sphereLodLevels[level].sectorCount, sphereLodLevels[level].stackCount, true);
+        lodMeshes[level].indexCount = indices.size() - lodMeshes[level].firstIndex;
+    }
+}
+
+// рівні сфери в assets.pack: заголовок, опис кожного рівня, далі вершини й індекси як у VBO/EBO
+const char* SPHERE_LODS_ASSET = "sphere_lods";
+
+struct PackedMeshHeader {
+    uint32_t levelCount;
+    uint32_t floatCount;
+    uint32_t indexCount;
+    uint32_t reserved;
+};
+
+struct PackedMeshLevel {
+    int32_t baseVertex;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    uint32_t reserved;
+};
+
+// кількість рівнів не ловить зміну секторів чи стеків, тож архів пам'ятає хеш усієї таблиці
+uint32_t sphereLodsSourceHash() {
+    return assetSourceHash(sphereLodLevels, sizeof(sphereLodLevels));
+}
+
+// вказівники на вершини й індекси прямо в архіві, якщо там ті самі рівні, що й у sphereLodLevels
+bool findPackedSphereLods(const float*& vertices, size_t& floatCount, const unsigned int*& indices, size_t& indexCount, SphereLodMesh* lodMeshes) {
+    size_t size = 0;
+    uint32_t sourceHash = 0;
+    const unsigned char* data = findAsset(assetPack, SPHERE_LODS_ASSET, ASSET_MESH, &size, &sourceHash);
+    if (!data || size < sizeof(PackedMeshHeader) || sourceHash != sphereLodsSourceHash())
+        return false;
+    PackedMeshHeader header;
+    memcpy(&header, data, sizeof(header));
+    const size_t levelsBytes = header.levelCount * sizeof(PackedMeshLevel);
+    if (header.levelCount != SPHERE_LOD_COUNT
+        || size != sizeof(header) + levelsBytes + header.floatCount * sizeof(float) + header.indexCount * sizeof(unsigned int))
+        return false;
+    const PackedMeshLevel* levels = (const PackedMeshLevel*)(data + sizeof(header));
+    for (int level = 0; level < SPHERE_LOD_COUNT; ++level) {
+        lodMeshes[level].baseVertex = levels[level].baseVertex;
+        lodMeshes[level].firstIndex = levels[level].firstIndex;
+        lodMeshes[level].indexCount = levels[level].indexCount;
+    }
+    vertices = (const float*)(data + sizeof(header) + levelsBytes);
+    floatCount = header.floatCount;
+    indices = (const unsigned int*)(vertices + floatCount);
+    indexCount = header.indexCount;
+    return true;
+}
+
+void flushCelestialBodies(const SceneProgram* scenePrograms) {
+    CPU_ZONE("flushCelestialBodies");
+    static GLuint VAO = 0, VBO = 0, EBO = 0, instanceVBO = 0;
+    static SphereLodMesh lodMeshes[SPHERE_LOD_COUNT];
+    static size_t instanceCapacity = 0;
+    static bool initialized = false;
+    static std::vector<BodyInstance> instances;
+
+    if (!initialized) {
+        std::vector<float> generatedVertices;
+        std::vector<unsigned int> generatedIndices;
+        const float* vertices = NULL;
+        const unsigned int* indices = NULL;
+        size_t floatCount = 0, indexCount = 0;
+        if (!findPackedSphereLods(vertices, floatCount, indices, indexCount, lodMeshes)) {
+            buildSphereLods(generatedVertices, generatedIndices, lodMeshes);
+            vertices = generatedVertices.data();
+            floatCount = generatedVertices.size();
+            indices = generatedIndices.data();
+            indexCount = generatedIndices.size();
+        }
 
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
+        glGenBuffers(1, &instanceVBO);
 
         glBindVertexArray(VAO);
 
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, floatCount * sizeof(float), vertices, GL_STATIC_DRAW);
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indices, GL_STATIC_DRAW);
 
         int stride = (3 + 2 + 3) * sizeof(float); 
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)(0));
@@ -320,60 +3951,513 @@ void drawCelestialBody(GLuint shaderProgram, glm::mat4 view, glm::mat4 projectio
         glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float)));
         glEnableVertexAttribArray(1);
 
-        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(5 * sizeof(float)));
-        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(5 * sizeof(float)));
+        glEnableVertexAttribArray(2);
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        for (GLuint location = 3; location <= 13; ++location) {
+            glEnableVertexAttribArray(location);
+            glVertexAttribDivisor(location, 1);
+        }
+        setBodyInstanceAttributes(0);
+
+        glBindVertexArray(0);
+        initialized = true;
+    }
+    if (queuedBodies.empty())
+        return;
+
+    // сортування за програмою, потім за рівнем деталізації: мінімум перемикань програм,
+    // а кожен рівень дає один instanced-виклик
+    std::stable_sort(queuedBodies.begin(), queuedBodies.end(), [](const QueuedBody& a, const QueuedBody& b) {
+        if (a.permutation != b.permutation)
+            return a.permutation < b.permutation;
+        return a.lod < b.lod;
+    });
+    instances.clear();
+    for (const auto& queued : queuedBodies)
+        instances.push_back(queued.instance);
+
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    if (instances.size() > instanceCapacity) {
+        instanceCapacity = instances.size() * 2;
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(BodyInstance), NULL, GL_STREAM_DRAW);
+    }
+    glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(BodyInstance), instances.data());
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, bodyTextures.id);
+    bindVirtualTextures(virtualTextures);
+
+    glBindVertexArray(VAO);
+    // прохід 0 - FEEDBACK для віртуальних текстур (усі тіла однією програмою, лише сітками),
+    // прохід 1 - звичайний
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    // пропущений прохід не відкриває інтервал, інакше "vt feedback" міряв би весь основний прохід
+    int feedbackScope = virtualTextureFeedbackReady(virtualTextures) ? beginGpuScope(gpuProfiler, permutationNames[PERMUTATION_FEEDBACK]) : -1;
+    const bool feedback = beginVirtualTextureFeedback(virtualTextures);
+    for (int pass = feedback ? 0 : 1; pass < 2; ++pass) {
+        int currentPermutation = -1;
+        int permutationScope = -1;
+        size_t first = 0;
+        while (first < queuedBodies.size()) {
+            size_t last = first;
+            while (last < queuedBodies.size() && queuedBodies[last].permutation == queuedBodies[first].permutation
+                && queuedBodies[last].lod == queuedBodies[first].lod)
+                ++last;
+            int permutation = pass == 0 ? PERMUTATION_FEEDBACK : queuedBodies[first].permutation;
+            if (permutation != currentPermutation) {
+                currentPermutation = permutation;
+                glUseProgram(scenePrograms[currentPermutation].program.id);
+                if (pass == 1) {
+                    endGpuScope(gpuProfiler, permutationScope);
+                    permutationScope = beginGpuScope(gpuProfiler, permutationNames[currentPermutation]);
+                }
+            }
+            setBodyInstanceAttributes(first);
+            if (isImpostorPermutation(currentPermutation)) {
+                // вершини квада будуються з gl_VertexID, буфер сфери не читається
+                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(last - first));
+            }
+            else {
+                // у імпосторів lod 0, а для координат сторінок потрібна хоч трохи кругла сфера
+                int lod = isImpostorPermutation(queuedBodies[first].permutation) ? std::min(2, SPHERE_LOD_COUNT - 1) : queuedBodies[first].lod;
+                const SphereLodMesh& mesh = lodMeshes[lod];
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(mesh.indexCount), GL_UNSIGNED_INT,
+                    (void*)(mesh.firstIndex * sizeof(unsigned int)), static_cast<GLsizei>(last - first), mesh.baseVertex);
+            }
+            first = last;
+        }
+        if (pass == 0) {
+            endVirtualTextureFeedback(virtualTextures, viewport);
+            endGpuScope(gpuProfiler, feedbackScope);
+        }
+        endGpuScope(gpuProfiler, permutationScope);
+    }
+    glBindVertexArray(0);
+    queuedBodies.clear();
+}
+
+// пояси астероїдів: орбіти генеруються один раз і лежать у GPU, рух рахує вершинний шейдер з того
+// самого day. усі астероїди кільця мають одну кутову швидкість, тож шматок поясу (кільце x сектор)
+// обертається як ціле: CPU щокадру перевіряє лише шматки, а не окремі тіла
+const int ASTEROID_DEFAULT_COUNT = 200000;
+const uint64_t ASTEROID_SEED = 0x5EED5EEDull;
+const int ASTEROID_BANDS = 32;   // кілець на пояс
+const int ASTEROID_SECTORS = 64; // секторів на кільце
+const float ASTEROID_MESH_PIXELS = 3.0f;    // від такого радіуса в пікселях - ікосаедр
+const float ASTEROID_COARSE_PIXELS = 0.75f; // від такого - октаедр, менше - точка
+const int ASTEROID_LOD_COUNT = 3;           // ікосаедр, октаедр, точки
+
+struct AsteroidBelt {
+    float innerRadius;
+    float outerRadius;
+    float minSize;
+    float maxSize;
+    float maxInclination; // градуси
+    float share;          // частка від загальної кількості
+};
+
+// одиниці сцени: головний пояс між Марсом (1.5) і Юпітером (3.0), пояс Койпера за Нептуном (8.0)
+const AsteroidBelt asteroidBelts[] = {
+    { 1.9f, 2.7f, 0.0015f, 0.006f, 10.0f, 0.8f },
+    { 8.8f, 11.0f, 0.003f, 0.012f, 12.0f, 0.2f },
+};
+const int ASTEROID_BELT_COUNT = sizeof(asteroidBelts) / sizeof(asteroidBelts[0]);
+
+struct AsteroidInstance {
+    glm::vec4 orbit; // x - радіус, y - фаза (град), z - кутова швидкість (град/день), w - нахил (рад)
+    glm::vec4 shape; // x - розмір, y - довгота вузла (рад), z - обертання (град/день), w - відтінок
+};
+
+struct AsteroidChunk {
+    GLint first;
+    GLsizei count;
+    float radius;      // середина кільця
+    float phase;       // середина сектора на day = 0, градуси
+    float orbitSpeed;  // градуси на день, спільна для кільця
+    float boundRadius; // сфера навколо шматка з урахуванням нахилів і розміру тіл
+    float maxSize;
+};
+
+struct AsteroidField {
+    int count = 0;
+    GLuint meshVAO = 0, pointVAO = 0;
+    GLuint meshVBO = 0, meshEBO = 0, instanceVBO = 0;
+    SphereLodMesh meshes[2];
+    std::vector<AsteroidChunk> chunks;
+    std::vector<std::pair<GLint, GLsizei>> ranges[ASTEROID_LOD_COUNT]; // видимі діапазони на кадр
+};
+AsteroidField asteroidField;
+
+// степенева апроксимація orbitSpeed планет сцени: Земля 15.8 на 1.0, Юпітер 7.1 на 3.0, Нептун 3.4 на 8.0
+float asteroidOrbitSpeed(float radius) {
+    return 15.8f * powf(radius, -0.73f);
+}
+
+void buildAsteroidMeshes(std::vector<float>& vertices, std::vector<unsigned int>& indices, SphereLodMesh* meshes) {
+    const float g = 0.5f * (1.0f + sqrtf(5.0f));
+    const float icosahedron[12][3] = {
+        { -1, g, 0 }, { 1, g, 0 }, { -1, -g, 0 }, { 1, -g, 0 },
+        { 0, -1, g }, { 0, 1, g }, { 0, -1, -g }, { 0, 1, -g },
+        { g, 0, -1 }, { g, 0, 1 }, { -g, 0, -1 }, { -g, 0, 1 },
+    };
+    const unsigned int icosahedronFaces[] = {
+        0, 11, 5, 0, 5, 1, 0, 1, 7, 0, 7, 10, 0, 10, 11, 1, 5, 9, 5, 11, 4, 11, 10, 2, 10, 7, 6, 7, 1, 8,
+        3, 9, 4, 3, 4, 2, 3, 2, 6, 3, 6, 8, 3, 8, 9, 4, 9, 5, 2, 4, 11, 6, 2, 10, 8, 6, 7, 9, 8, 1,
+    };
+    const float octahedron[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+    const unsigned int octahedronFaces[] = { 0, 2, 4, 4, 2, 1, 1, 2, 5, 5, 2, 0, 4, 3, 0, 1, 3, 4, 5, 3, 1, 0, 3, 5 };
+
+    meshes[0].baseVertex = 0;
+    meshes[0].firstIndex = 0;
+    meshes[0].indexCount = sizeof(icosahedronFaces) / sizeof(icosahedronFaces[0]);
+    for (const auto& vertex : icosahedron) {
+        glm::vec3 unit = glm::normalize(glm::vec3(vertex[0], vertex[1], vertex[2]));
+        vertices.insert(vertices.end(), { unit.x, unit.y, unit.z });
+    }
+    indices.insert(indices.end(), icosahedronFaces, icosahedronFaces + meshes[0].indexCount);
+
+    meshes[1].baseVertex = 12;
+    meshes[1].firstIndex = indices.size();
+    meshes[1].indexCount = sizeof(octahedronFaces) / sizeof(octahedronFaces[0]);
+    for (const auto& vertex : octahedron)
+        vertices.insert(vertices.end(), { vertex[0], vertex[1], vertex[2] });
+    indices.insert(indices.end(), octahedronFaces, octahedronFaces + meshes[1].indexCount);
+}
+
+void setAsteroidInstanceAttributes(size_t firstInstance) {
+    const size_t stride = sizeof(AsteroidInstance);
+    const size_t base = firstInstance * stride;
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, (GLsizei)stride, (void*)(base + offsetof(AsteroidInstance, orbit)));
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, (GLsizei)stride, (void*)(base + offsetof(AsteroidInstance, shape)));
+}
+
+// астероїди впорядковані за шматками, тож кожен шматок - суцільний діапазон інстансів
+void createAsteroidField(AsteroidField& field, int count) {
+    const int chunkCount = ASTEROID_BELT_COUNT * ASTEROID_BANDS * ASTEROID_SECTORS;
+    std::vector<AsteroidInstance> generated(count);
+    std::vector<int> chunkOf(count);
+    std::vector<int> chunkSizes(chunkCount, 0);
+    uint64_t random = ASTEROID_SEED;
+    int index = 0;
+    for (int beltIndex = 0; beltIndex < ASTEROID_BELT_COUNT; ++beltIndex) {
+        const AsteroidBelt& belt = asteroidBelts[beltIndex];
+        int beltCount = beltIndex + 1 == ASTEROID_BELT_COUNT ? count - index : (int)(count * belt.share);
+        const float bandWidth = (belt.outerRadius - belt.innerRadius) / ASTEROID_BANDS;
+        for (int i = 0; i < beltCount; ++i, ++index) {
+            // трикутний розподіл: пояс густіший посередині й рідшає до країв
+            float radius = belt.innerRadius + (belt.outerRadius - belt.innerRadius) * 0.5f * (randomFloat(random) + randomFloat(random));
+            int band = std::min((int)((radius - belt.innerRadius) / bandWidth), ASTEROID_BANDS - 1);
+            float phase = 360.0f * randomFloat(random);
+            int sector = std::min((int)(phase / 360.0f * ASTEROID_SECTORS), ASTEROID_SECTORS - 1);
+            float size = randomFloat(random);
+            AsteroidInstance& asteroid = generated[index];
+            asteroid.orbit = glm::vec4(radius, phase, asteroidOrbitSpeed(belt.innerRadius + (band + 0.5f) * bandWidth),
+                glm::radians(belt.maxInclination * randomFloat(random)));
+            asteroid.shape = glm::vec4(belt.minSize + (belt.maxSize - belt.minSize) * size * size * size, 2.0f * PI * randomFloat(random),
+                (randomFloat(random) * 2.0f - 1.0f) * 40.0f, randomFloat(random));
+            chunkOf[index] = (beltIndex * ASTEROID_BANDS + band) * ASTEROID_SECTORS + sector;
+            ++chunkSizes[chunkOf[index]];
+        }
+    }
+
+    field.chunks.resize(chunkCount);
+    GLint first = 0;
+    for (int chunk = 0; chunk < chunkCount; ++chunk) {
+        const AsteroidBelt& belt = asteroidBelts[chunk / (ASTEROID_BANDS * ASTEROID_SECTORS)];
+        const int band = chunk / ASTEROID_SECTORS % ASTEROID_BANDS;
+        const float bandWidth = (belt.outerRadius - belt.innerRadius) / ASTEROID_BANDS;
+        const float halfSector = PI / ASTEROID_SECTORS;
+        AsteroidChunk& bounds = field.chunks[chunk];
+        bounds.first = first;
+        bounds.count = chunkSizes[chunk];
+        bounds.radius = belt.innerRadius + (band + 0.5f) * bandWidth;
+        bounds.phase = (chunk % ASTEROID_SECTORS + 0.5f) * 360.0f / ASTEROID_SECTORS;
+        bounds.orbitSpeed = asteroidOrbitSpeed(bounds.radius);
+        float outer = bounds.radius + 0.5f * bandWidth;
+        float radial = 0.5f * bandWidth + outer * (1.0f - cosf(halfSector));
+        float lateral = outer * sinf(halfSector);
+        float height = outer * sinf(glm::radians(belt.maxInclination));
+        bounds.maxSize = belt.maxSize;
+        bounds.boundRadius = sqrtf(radial * radial + lateral * lateral + height * height) + belt.maxSize;
+        first += chunkSizes[chunk];
+    }
+    std::vector<AsteroidInstance> instances(count);
+    std::vector<GLint> next(chunkCount);
+    for (int chunk = 0; chunk < chunkCount; ++chunk)
+        next[chunk] = field.chunks[chunk].first;
+    for (int i = 0; i < count; ++i)
+        instances[next[chunkOf[i]]++] = generated[i];
+
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    buildAsteroidMeshes(vertices, indices, field.meshes);
+
+    glGenVertexArrays(1, &field.meshVAO);
+    glGenVertexArrays(1, &field.pointVAO);
+    glGenBuffers(1, &field.meshVBO);
+    glGenBuffers(1, &field.meshEBO);
+    glGenBuffers(1, &field.instanceVBO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, field.instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(AsteroidInstance), instances.data(), GL_STATIC_DRAW);
+
+    glBindVertexArray(field.meshVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, field.meshVBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, field.meshEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, field.instanceVBO);
+    for (GLuint location = 3; location <= 4; ++location) {
+        glEnableVertexAttribArray(location);
+        glVertexAttribDivisor(location, 1);
+    }
+    setAsteroidInstanceAttributes(0);
+
+    // точки: ті самі дані як звичайні вершини, діапазон задає first у glDrawArrays
+    glBindVertexArray(field.pointVAO);
+    for (GLuint location = 3; location <= 4; ++location)
+        glEnableVertexAttribArray(location);
+    setAsteroidInstanceAttributes(0);
+    glBindVertexArray(0);
+
+    field.count = count;
+    std::cout << "Asteroid field: " << count << " bodies in " << chunkCount << " chunks ("
+        << instances.size() * sizeof(AsteroidInstance) / (1024 * 1024) << " MB)" << std::endl;
+}
 
-        glBindVertexArray(0);
+void drawAsteroids(const SceneProgram* scenePrograms) {
+    AsteroidField& field = asteroidField;
+    if (field.count == 0)
+        return;
+    CPU_ZONE("drawAsteroids");
+    GpuProfileScope profileScope(permutationNames[PERMUTATION_ASTEROID]);
+    for (int lod = 0; lod < ASTEROID_LOD_COUNT; ++lod)
+        field.ranges[lod].clear();
+    for (const AsteroidChunk& chunk : field.chunks) {
+        if (chunk.count == 0)
+            continue;
+        float angle = glm::radians(chunk.phase + day * chunk.orbitSpeed);
+        glm::vec3 center(chunk.radius * cosf(angle), 0.0f, -chunk.radius * sinf(angle));
+        if (!sphereInFrustum(cameraFrustum, center, chunk.boundRadius))
+            continue;
+        // найбільше тіло на найближчій до камери точці шматка
+        float distance = glm::length(center - cameraPos) - chunk.boundRadius;
+        float pixelRadius = distance > chunk.maxSize ? chunk.maxSize / distance * lodPixelScale : 1e30f;
+        int lod = pixelRadius >= ASTEROID_MESH_PIXELS ? 0 : pixelRadius >= ASTEROID_COARSE_PIXELS ? 1 : 2;
+        std::vector<std::pair<GLint, GLsizei>>& ranges = field.ranges[lod];
+        // сусідні шматки лежать підряд у буфері, тож зливаються в один виклик
+        if (!ranges.empty() && ranges.back().first + ranges.back().second == chunk.first)
+            ranges.back().second += chunk.count;
+        else
+            ranges.push_back(std::make_pair(chunk.first, chunk.count));
+    }
 
-        vaoMap[celestialBody.size] = VAO;
-        vboMap[celestialBody.size] = VBO;
-        eboMap[celestialBody.size] = EBO;
-        indexCountMap[celestialBody.size] = indices.size();
+    glBindVertexArray(field.meshVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, field.instanceVBO);
+    glUseProgram(scenePrograms[PERMUTATION_ASTEROID].program.id);
+    for (int lod = 0; lod < 2; ++lod) {
+        const SphereLodMesh& mesh = field.meshes[lod];
+        for (const auto& range : field.ranges[lod]) {
+            setAsteroidInstanceAttributes(range.first);
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(mesh.indexCount), GL_UNSIGNED_INT,
+                (void*)(mesh.firstIndex * sizeof(unsigned int)), range.second, mesh.baseVertex);
+        }
     }
-    else {
-        VAO = vaoMap[celestialBody.size];
-        VBO = vboMap[celestialBody.size];
-        EBO = eboMap[celestialBody.size];
-        indexCount = indexCountMap[celestialBody.size];
+    glBindVertexArray(field.pointVAO);
+    glUseProgram(scenePrograms[PERMUTATION_ASTEROID_POINTS].program.id);
+    for (const auto& range : field.ranges[2])
+        glDrawArrays(GL_POINTS, range.first, range.second);
+    glBindVertexArray(0);
+}
+// --pack: текстури (перемасштабовані й з mip-рівнями, як для потокового завантаження), рівні сфери
+// і шейдери записуються в один assets.pack; після зміни pictures/ архів треба перепакувати
+const char* VERTEX_SHADER_ASSET = "scene.vert";
+const char* FRAGMENT_SHADER_ASSET = "scene.frag";
+
+struct PackSource {
+    std::string name;
+    AssetType type;
+    uint32_t sourceHash = 0;
+    std::vector<std::pair<const void*, size_t>> chunks;
+    size_t size = 0;
+};
+
+void addPackChunk(PackSource& source, const void* data, size_t size) {
+    source.chunks.push_back(std::make_pair(data, size));
+    source.size += size;
+}
+
+// затравка хешу, з якою кожне ім'я потрапляє у власний слот таблиці
+bool findAssetPackSeed(const std::vector<PackSource>& sources, uint32_t tableSize, uint64_t& seed) {
+    std::vector<bool> used(tableSize);
+    for (seed = 1; seed <= 100000; ++seed) {
+        std::fill(used.begin(), used.end(), false);
+        bool collision = false;
+        for (size_t i = 0; i < sources.size() && !collision; ++i) {
+            uint32_t slot = assetPackSlot(sources[i].name.c_str(), seed, tableSize);
+            collision = used[slot];
+            used[slot] = true;
+        }
+        if (!collision)
+            return true;
     }
-    glm::mat4 model = parentModel;
+    return false;
+}
 
-    float orbitAngle = glm::radians(day * celestialBody.orbitSpeed);
-    model = glm::rotate(model, orbitAngle, glm::vec3(0.0f, 1.0f, 0.0f));
-    model = glm::translate(model, glm::vec3(celestialBody.orbitRadius, 0.0f, 0.0f));
+bool writePadding(FILE* file, size_t bytes) {
+    static const unsigned char zeros[ASSET_PACK_ALIGNMENT] = {};
+    return bytes == 0 || fwrite(zeros, 1, bytes, file) == bytes;
+}
 
-    model = glm::rotate(model, glm::radians(celestialBody.axisTilt), glm::vec3(1.0f, 0.0f, 0.0f));
+int writeAssetPack(const TextureArray& textureArray, const char* path) {
+    DecodeBatch batch;
+    for (size_t layer = 0; layer < textureArray.layerPaths.size(); ++layer)
+        submitDecode(workerPool, batch, textureArray.layerPaths[layer], textureArray.width, textureArray.height, true);
+    submitDecode(workerPool, batch, SKY_TEXTURE_PATH, 0, 0, true);
+    while (batch.pending > 0)
+        waitForDecode(batch);
 
-    float selfRotationAngle = glm::radians(day * celestialBody.rotationSpeed * celestialBody.rotationDirection);
-    model = glm::rotate(model, selfRotationAngle, glm::vec3(0.0f, 1.0f, 0.0f));
+    std::vector<PackSource> sources;
+    std::vector<TextureCacheHeader> textureHeaders(batch.images.size());
+    int failed = 0;
+    for (size_t i = 0; i < batch.images.size(); ++i) {
+        const DecodedImage& image = batch.images[i];
+        if (image.levelPixels.empty()) {
+            ++failed;
+            continue;
+        }
+        uint64_t key = 0;
+        decodedCacheKey(image, key);
+        TextureCacheHeader header = { TEXTURE_CACHE_MAGIC, TEXTURE_CACHE_VERSION, key, (uint32_t)image.width, (uint32_t)image.height,
+            (uint32_t)image.channels, (uint32_t)image.levelPixels.size() };
+        textureHeaders[i] = header;
+        PackSource source;
+        source.name = assetName(image.path);
+        source.type = ASSET_TEXTURE;
+        addPackChunk(source, &textureHeaders[i], sizeof(TextureCacheHeader));
+        for (size_t level = 0; level < image.levelPixels.size(); ++level) {
+            addPackChunk(source, image.levelPixels[level],
+                (size_t)std::max(image.width >> level, 1) * std::max(image.height >> level, 1) * image.channels);
+        }
+        sources.push_back(source);
+    }
 
-    glUseProgram(shaderProgram);
+    std::vector<float> vertices;
+    std::vector<unsigned int> indices;
+    SphereLodMesh lodMeshes[SPHERE_LOD_COUNT];
+    buildSphereLods(vertices, indices, lodMeshes);
+    PackedMeshHeader meshHeader = { (uint32_t)SPHERE_LOD_COUNT, (uint32_t)vertices.size(), (uint32_t)indices.size(), 0 };
+    PackedMeshLevel meshLevels[SPHERE_LOD_COUNT];
+    for (int level = 0; level < SPHERE_LOD_COUNT; ++level) {
+        PackedMeshLevel packed = { lodMeshes[level].baseVertex, (uint32_t)lodMeshes[level].firstIndex, (uint32_t)lodMeshes[level].indexCount, 0 };
+        meshLevels[level] = packed;
+    }
+    PackSource mesh;
+    mesh.name = SPHERE_LODS_ASSET;
+    mesh.type = ASSET_MESH;
+    mesh.sourceHash = sphereLodsSourceHash();
+    addPackChunk(mesh, &meshHeader, sizeof(meshHeader));
+    addPackChunk(mesh, meshLevels, sizeof(meshLevels));
+    addPackChunk(mesh, vertices.data(), vertices.size() * sizeof(float));
+    addPackChunk(mesh, indices.data(), indices.size() * sizeof(unsigned int));
+    sources.push_back(mesh);
 
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    const char* shaderNames[2] = { VERTEX_SHADER_ASSET, FRAGMENT_SHADER_ASSET };
+    const char* shaderSources[2] = { vertexShaderSource, fragmentShaderSource };
+    for (int i = 0; i < 2; ++i) {
+        PackSource shader;
+        shader.name = shaderNames[i];
+        shader.type = ASSET_SHADER;
+        shader.sourceHash = assetSourceHash(shaderSources[i], strlen(shaderSources[i]));
+        addPackChunk(shader, shaderSources[i], strlen(shaderSources[i]) + 1);
+        sources.push_back(shader);
+    }
 
-    glUniform3fv(glGetUniformLocation(shaderProgram, "viewPos"), 1, glm::value_ptr(viewPos));
+    for (size_t i = 0; i < sources.size(); ++i) {
+        if (sources[i].name.size() >= sizeof(AssetPackEntry().name)) {
+            std::cout << "Asset name too long for the pack: " << sources[i].name << std::endl;
+            return failed + 1;
+        }
+    }
+    uint32_t tableSize = 1;
+    while (tableSize < sources.size() * 2)
+        tableSize *= 2;
+    uint64_t seed = 0;
+    while (!findAssetPackSeed(sources, tableSize, seed))
+        tableSize *= 2;
 
-    glUniform3f(glGetUniformLocation(shaderProgram, "light.position"), 0.0f, 0.0f, 0.0f);
-    glUniform3f(glGetUniformLocation(shaderProgram, "light.ambient"), 0.2f, 0.2f, 0.2f);
-    glUniform3f(glGetUniformLocation(shaderProgram, "light.diffuse"), 0.8f, 0.8f, 0.8f);
-    glUniform3f(glGetUniformLocation(shaderProgram, "light.specular"), 1.0f, 1.0f, 1.0f);
+    AssetPackHeader header = { ASSET_PACK_MAGIC, ASSET_PACK_VERSION, (uint32_t)sources.size(), tableSize, seed };
+    std::vector<AssetPackEntry> entries(sources.size());
+    std::vector<uint32_t> table(tableSize, ASSET_PACK_EMPTY_SLOT);
+    size_t offset = sizeof(header) + entries.size() * sizeof(AssetPackEntry) + table.size() * sizeof(uint32_t);
+    for (size_t i = 0; i < sources.size(); ++i) {
+        memset(&entries[i], 0, sizeof(AssetPackEntry));
+        strcpy(entries[i].name, sources[i].name.c_str());
+        entries[i].type = (uint32_t)sources[i].type;
+        entries[i].sourceHash = sources[i].sourceHash;
+        offset = (offset + ASSET_PACK_ALIGNMENT - 1) / ASSET_PACK_ALIGNMENT * ASSET_PACK_ALIGNMENT;
+        entries[i].offset = offset;
+        entries[i].size = sources[i].size;
+        offset += sources[i].size;
+        table[assetPackSlot(sources[i].name.c_str(), seed, tableSize)] = (uint32_t)i;
+    }
 
-    glUniform3fv(glGetUniformLocation(shaderProgram, "material.ambient"), 1, glm::value_ptr(celestialBody.material.ambient));
-    glUniform3fv(glGetUniformLocation(shaderProgram, "material.specular"), 1, glm::value_ptr(celestialBody.material.specular));
-    glUniform1f(glGetUniformLocation(shaderProgram, "material.shininess"), celestialBody.material.shininess);
-    glUniform3fv(glGetUniformLocation(shaderProgram, "material.emission"), 1, glm::value_ptr(celestialBody.material.emission));
+    std::string temporaryPath = std::string(path) + ".tmp";
+    FILE* file = fopen(temporaryPath.c_str(), "wb");
+    if (!file) {
+        std::cout << "Failed to write " << temporaryPath << std::endl;
+        return failed + 1;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(entries.data(), sizeof(AssetPackEntry), entries.size(), file) == entries.size()
+        && fwrite(table.data(), sizeof(uint32_t), table.size(), file) == table.size();
+    size_t position = sizeof(header) + entries.size() * sizeof(AssetPackEntry) + table.size() * sizeof(uint32_t);
+    for (size_t i = 0; written && i < sources.size(); ++i) {
+        written = writePadding(file, (size_t)entries[i].offset - position);
+        for (size_t chunk = 0; written && chunk < sources[i].chunks.size(); ++chunk)
+            written = fwrite(sources[i].chunks[chunk].first, 1, sources[i].chunks[chunk].second, file) == sources[i].chunks[chunk].second;
+        position = (size_t)(entries[i].offset + entries[i].size);
+    }
+    written = fclose(file) == 0 && written;
+    remove(path);
+    if (!written || rename(temporaryPath.c_str(), path) != 0) {
+        remove(temporaryPath.c_str());
+        std::cout << "Failed to write " << path << std::endl;
+        return failed + 1;
+    }
+    for (size_t i = 0; i < batch.images.size(); ++i)
+        releaseDecodedImage(batch.images[i]);
+    std::cout << "Packed " << sources.size() << " assets into " << path << " (" << position / (1024 * 1024) << " MB, "
+        << tableSize << " hash slots)" << std::endl;
+    return failed;
+}
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, celestialBody.textureID);
-    glUniform1i(glGetUniformLocation(shaderProgram, "material.texture_diffuse"), 0);
-    glUniform1i(glGetUniformLocation(shaderProgram, "isSkybox"), 0);
+// текст шейдера з архіву, лише якщо його спаковано з тих самих вбудованих джерел; інакше
+// архів зібрано старішою програмою, і його шейдери не знають нових перестановок і блоків
+const char* findPackedShaderSource(const char* name, const char* builtInSource) {
+    size_t size = 0;
+    uint32_t sourceHash = 0;
+    const char* source = (const char*)findAsset(assetPack, name, ASSET_SHADER, &size, &sourceHash);
+    if (!source || size == 0 || source[size - 1] != '\0')
+        return builtInSource;
+    if (sourceHash != assetSourceHash(builtInSource, strlen(builtInSource))) {
+        std::cout << "Ignoring stale " << name << " in the asset pack; rebuild it with --pack" << std::endl;
+        return builtInSource;
+    }
+    return source;
+}
 
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(indexCountMap[celestialBody.size]), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+// тексти шейдерів з архіву замість вбудованих; ключ кешу програм береться з тексту, тож кеш не плутається
+void usePackedShaderSources() {
+    vertexShaderSource = findPackedShaderSource(VERTEX_SHADER_ASSET, vertexShaderSource);
+    fragmentShaderSource = findPackedShaderSource(FRAGMENT_SHADER_ASSET, fragmentShaderSource);
 }
+
 void initСelestialBodies() {
     celestialBodies.clear();
     CelestialBody mercury;
@@ -387,8 +4471,9 @@ void initСelestialBodies() {
     mercury.material.specular = glm::vec3(0.1f, 0.1f, 0.1f);
     mercury.material.shininess = 8.0f;
     mercury.material.emission = glm::vec3(0.0f);
+    mercury.mass = 1.66e-7f;
     mercury.texturePath = "D:/vscode_asd_laz/test_shaders/pictures/mercury.jpg";
-    mercury.textureID = loadTexture(mercury.texturePath);
+    mercury.textureLayer = addTextureArrayLayer(bodyTextures, mercury.texturePath);
     celestialBodies.push_back(mercury);
 
     CelestialBody venus;
@@ -402,8 +4487,9 @@ void initСelestialBodies() {
     venus.material.specular = glm::vec3(0.4f, 0.4f, 0.4f);
     venus.material.shininess = 50.0f;
     venus.material.emission = glm::vec3(0.0f);
+    venus.mass = 2.45e-6f;
     venus.texturePath = "D:/vscode_asd_laz/test_shaders/pictures/venus.jpg";
-    venus.textureID = loadTexture(venus.texturePath);
+    venus.textureLayer = addTextureArrayLayer(bodyTextures, venus.texturePath);
     celestialBodies.push_back(venus);
 
     CelestialBody mars;
@@ -417,8 +4503,9 @@ void initСelestialBodies() {
     mars.material.specular = glm::vec3(0.2f, 0.2f, 0.2f);
     mars.material.shininess = 16.0f;
     mars.material.emission = glm::vec3(0.0f);
+    mars.mass = 3.23e-7f;
     mars.texturePath = "D:/vscode_asd_laz/test_shaders/pictures/mars.jpg";
-    mars.textureID = loadTexture(mars.texturePath);
+    mars.textureLayer = addTextureArrayLayer(bodyTextures, mars.texturePath);
     celestialBodies.push_back(mars);
 
     CelestialBody jupiter;
@@ -432,8 +4519,9 @@ void initСelestialBodies() {
     jupiter.material.specular = glm::vec3(0.2f, 0.2f, 0.2f);
     jupiter.material.shininess = 20.0f;
     jupiter.material.emission = glm::vec3(0.0f);
+    jupiter.mass = 9.55e-4f;
     jupiter.texturePath = "D:/vscode_asd_laz/test_shaders/pictures/jupiter.jpg";
-    jupiter.textureID = loadTexture(jupiter.texturePath);
+    jupiter.textureLayer = addTextureArrayLayer(bodyTextures, jupiter.texturePath);
     celestialBodies.push_back(jupiter);
 
     CelestialBody saturn;
@@ -447,8 +4535,9 @@ void initСelestialBodies() {
     saturn.material.specular = glm::vec3(0.3f, 0.3f, 0.3f);
     saturn.material.shininess = 23.0f;
     saturn.material.emission = glm::vec3(0.0f);
+    saturn.mass = 2.86e-4f;
     saturn.texturePath = "D:/vscode_asd_laz/test_shaders/pictures/saturn.jpg";
-    saturn.textureID = loadTexture(saturn.texturePath);
+    saturn.textureLayer = addTextureArrayLayer(bodyTextures, saturn.texturePath);
     celestialBodies.push_back(saturn);
 
     CelestialBody uran;
@@ -462,8 +4551,9 @@ void initСelestialBodies() {
     uran.material.specular = glm::vec3(0.2f, 0.2f, 0.2f);
     uran.material.shininess = 28.0f;
     uran.material.emission = glm::vec3(0.0f);
+    uran.mass = 4.37e-5f;
     uran.texturePath = "D:/vscode_asd_laz/test_shaders/pictures/uranus.jpg";
-    uran.textureID = loadTexture(uran.texturePath);
+    uran.textureLayer = addTextureArrayLayer(bodyTextures, uran.texturePath);
     celestialBodies.push_back(uran);
 
     CelestialBody neptun;
@@ -477,16 +4567,28 @@ void initСelestialBodies() {
     neptun.material.specular = glm::vec3(0.5f, 0.5f, 0.5f);
     neptun.material.shininess = 32.0f;
     neptun.material.emission = glm::vec3(0.0f);
+    neptun.mass = 5.15e-5f;
     neptun.texturePath = "D:/vscode_asd_laz/test_shaders/pictures/neptun.jpg";
-    neptun.textureID = loadTexture(neptun.texturePath);
+    neptun.textureLayer = addTextureArrayLayer(bodyTextures, neptun.texturePath);
     celestialBodies.push_back(neptun);
 }
 
 void processInput(GLFWwindow* window){
+    CPU_ZONE("processInput");
     float cameraSpeed = 2.5f * deltaTime; 
 
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
+    static bool impostorKeyWasPressed = false;
+    bool impostorKeyPressed = glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS;
+    if (impostorKeyPressed && !impostorKeyWasPressed)
+        impostorMode = !impostorMode;
+    impostorKeyWasPressed = impostorKeyPressed;
+    static bool traceKeyWasPressed = false;
+    bool traceKeyPressed = glfwGetKey(window, GLFW_KEY_F9) == GLFW_PRESS;
+    if (traceKeyPressed && !traceKeyWasPressed)
+        writeCpuTrace();
+    traceKeyWasPressed = traceKeyPressed;
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
         cameraPos += cameraSpeed * cameraFront;
     if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
@@ -541,43 +4643,947 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos){
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height){
     glViewport(0, 0, width, height);
+    // згорнуте вікно дає 0x0, а з нього рахується співвідношення сторін
+    framebufferWidth = std::max(width, 1);
+    framebufferHeight = std::max(height, 1);
 }
 
-int main(){
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Solar System", NULL, NULL);
-    if (window == NULL) {
-        std::cerr << "Не вдалося створити вікно GLFW" << std::endl;
-        glfwTerminate();
-        return -1;
+void renderScene(const SceneProgram* scenePrograms, CelestialBody& sun, const CelestialBody& earth, CelestialBody& moon) {
+    CPU_ZONE("renderScene");
+    glm::mat4 sunModel = glm::mat4(1.0f);
+    glm::mat4 earthModel = glm::mat4(1.0f);
+    glm::mat4 view, projection;
+    {
+        CPU_ZONE("composeMatrices");
+        earthModel = computeOrbitFrame(earth, earthModel);
+        earthModel = glm::rotate(earthModel, glm::radians(earth.axisTilt), glm::vec3(1.0f, 0.0f, 0.0f));
+        float earthSelfRotationAngle = glm::radians(day * earth.rotationSpeed * earth.rotationDirection);
+        earthModel = glm::rotate(earthModel, earthSelfRotationAngle, glm::vec3(0.0f, 1.0f, 0.0f));
+        view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+        projection = glm::perspective(glm::radians(fov), (float)framebufferWidth / framebufferHeight, 0.1f, 100.0f);
+    }
+
+    GpuProfileScope profileScope("scene");
+    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    updateFrameUniforms(view, projection, cameraPos);
+    beginFrameCulling(view, projection);
+    beginFrameLod(projection, (float)framebufferHeight);
+    drawCelestialBody(sun);
+    for (auto& celestialBody : celestialBodies) {
+        drawCelestialBody(celestialBody, sunModel);
+    }
+    drawCelestialBody(moon, earthModel);
+    flushCelestialBodies(scenePrograms);
+    drawAsteroids(scenePrograms);
+    drawSky(scenePrograms[PERMUTATION_SKY]);
+}
+
+// однаковий кадр (час і камера не рухаються) сіткою і імпосторами; glFinish у кожному кадрі,
+// тож час включає і CPU, і GPU
+void compareBodyRenderers(const SceneProgram* scenePrograms, CelestialBody& sun, const CelestialBody& earth, CelestialBody& moon, int frames) {
+    const bool savedMode = impostorMode;
+    double msPerFrame[2];
+    for (int mode = 0; mode < 2; ++mode) {
+        impostorMode = mode == 1;
+        renderScene(scenePrograms, sun, earth, moon);
+        glFinish();
+        auto start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < frames; ++frame) {
+            renderScene(scenePrograms, sun, earth, moon);
+            glFinish();
+        }
+        msPerFrame[mode] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+    }
+    impostorMode = savedMode;
+    std::cout << "Body renderer comparison over " << frames << " frames (" << cullStats.visible << " visible bodies): "
+        << "mesh " << msPerFrame[0] << " ms/frame, impostor " << msPerFrame[1] << " ms/frame" << std::endl;
+}
+
+// --benchmark: фіксований крок симуляції і камера за сплайном, тож кожен запуск малює ті самі кадри
+const float BENCHMARK_TIMESTEP = 1.0f / 60.0f;
+const int BENCHMARK_DEFAULT_FRAMES = 1200; // один прохід маршруту
+const int BENCHMARK_WARMUP_FRAMES = 10;    // не входять у статистику
+const double BENCHMARK_TOLERANCE = 0.10;   // допустиме погіршення p50/p95 відносно базового файлу
+
+struct CameraKey {
+    float time;       // секунди симуляції
+    const char* body; // NULL - світові координати, інакше зсув від центру тіла з такою текстурою
+    glm::vec3 position;
+    glm::vec3 target;
+};
+
+// проліт крізь внутрішні орбіти, близький проліт біля Юпітера, загальний план згори, повернення на старт
+const CameraKey benchmarkPath[] = {
+    {  0.0f, NULL,          glm::vec3(0.0f, 1.0f, 10.0f),  glm::vec3(0.0f) },
+    {  3.0f, NULL,          glm::vec3(2.5f, 0.6f, 2.0f),   glm::vec3(0.0f) },
+    {  6.0f, NULL,          glm::vec3(-1.5f, 0.3f, -1.2f), glm::vec3(0.0f) },
+    {  9.0f, "jupiter.jpg", glm::vec3(2.0f, 0.6f, 2.0f),   glm::vec3(0.0f) },
+    { 11.0f, "jupiter.jpg", glm::vec3(0.0f, 0.3f, 1.4f),   glm::vec3(0.0f) },
+    { 13.0f, "jupiter.jpg", glm::vec3(-1.4f, 0.2f, 0.0f),  glm::vec3(0.0f) },
+    { 16.0f, NULL,          glm::vec3(0.0f, 14.0f, 14.0f), glm::vec3(0.0f) },
+    { 20.0f, NULL,          glm::vec3(0.0f, 1.0f, 10.0f),  glm::vec3(0.0f) },
+};
+const int BENCHMARK_PATH_KEYS = sizeof(benchmarkPath) / sizeof(benchmarkPath[0]);
+
+void resolveCameraKey(const CameraKey& key, glm::vec3& position, glm::vec3& target) {
+    glm::vec3 origin(0.0f);
+    if (key.body) {
+        for (const CelestialBody& celestialBody : celestialBodies) {
+            if (assetName(celestialBody.texturePath) == key.body)
+                origin = glm::vec3(computeBodyModel(celestialBody, glm::mat4(1.0f))[3]);
+        }
+    }
+    position = origin + key.position;
+    target = origin + key.target;
+}
+
+glm::vec3 catmullRom(const glm::vec3* points, float t) {
+    float t2 = t * t, t3 = t2 * t;
+    return 0.5f * (2.0f * points[1] + (points[2] - points[0]) * t +
+        (2.0f * points[0] - 5.0f * points[1] + 4.0f * points[2] - points[3]) * t2 +
+        (3.0f * points[1] - points[0] - 3.0f * points[2] + points[3]) * t3);
+}
+
+// ключі тіл розв'язуються на поточний день, тож камера летить разом з планетою
+void applyBenchmarkCamera(float time) {
+    time = fmodf(time, benchmarkPath[BENCHMARK_PATH_KEYS - 1].time);
+    int segment = 0;
+    while (segment < BENCHMARK_PATH_KEYS - 2 && time >= benchmarkPath[segment + 1].time)
+        ++segment;
+    float t = (time - benchmarkPath[segment].time) / (benchmarkPath[segment + 1].time - benchmarkPath[segment].time);
+    glm::vec3 positions[4], targets[4];
+    for (int i = 0; i < 4; ++i) {
+        int key = std::min(std::max(segment - 1 + i, 0), BENCHMARK_PATH_KEYS - 1);
+        resolveCameraKey(benchmarkPath[key], positions[i], targets[i]);
+    }
+    cameraPos = catmullRom(positions, t);
+    cameraFront = glm::normalize(catmullRom(targets, t) - cameraPos);
+}
+
+struct BenchmarkRun {
+    int frames = 0; // 0 - звичайний режим
+    std::string outputPath;
+    std::string baselinePath;
+    std::vector<double> cpuFrameMs;
+    std::chrono::steady_clock::time_point frameStart;
+};
+
+BenchmarkRun benchmark;
+
+// час CPU - інтервал між початками сусідніх кадрів, разом з очікуванням драйвера
+void markBenchmarkFrame(BenchmarkRun& run, int frame) {
+    auto now = std::chrono::steady_clock::now();
+    if (frame > BENCHMARK_WARMUP_FRAMES)
+        run.cpuFrameMs.push_back(std::chrono::duration<double, std::milli>(now - run.frameStart).count());
+    run.frameStart = now;
+}
+
+struct FrameTimeStats {
+    double mean, p50, p95, p99, max;
+};
+
+FrameTimeStats computeFrameTimeStats(std::vector<double> samples) {
+    FrameTimeStats stats = {};
+    if (samples.empty())
+        return stats;
+    std::sort(samples.begin(), samples.end());
+    // перцентиль за найближчим рангом: значення, не менше за p% вибірки
+    auto percentile = [&samples](double p) {
+        size_t rank = (size_t)std::ceil(p / 100.0 * samples.size());
+        return samples[std::min(std::max(rank, (size_t)1), samples.size()) - 1];
+    };
+    double total = 0.0;
+    for (double sample : samples)
+        total += sample;
+    stats.mean = total / samples.size();
+    stats.p50 = percentile(50.0);
+    stats.p95 = percentile(95.0);
+    stats.p99 = percentile(99.0);
+    stats.max = samples.back();
+    return stats;
+}
+
+std::string frameTimeStatsJson(const std::vector<double>& samples) {
+    if (samples.empty())
+        return "null";
+    FrameTimeStats stats = computeFrameTimeStats(samples);
+    char json[256];
+    snprintf(json, sizeof(json), "{\"samples\": %zu, \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}",
+        samples.size(), stats.mean, stats.p50, stats.p95, stats.p99, stats.max);
+    return json;
+}
+
+// розбір лише власного формату: "key" всередині об'єкта "group": {...} (без вкладених об'єктів).
+// група може бути null (немає замірів) - тоді значення немає, а не число з наступної групи
+bool readBenchmarkValue(const std::string& json, const char* group, const char* key, double& value) {
+    const std::string groupName = std::string("\"") + group + "\":";
+    size_t groupPos = json.find(groupName);
+    if (groupPos == std::string::npos)
+        return false;
+    size_t open = json.find_first_not_of(" \t\r\n", groupPos + groupName.size());
+    if (open == std::string::npos || json[open] != '{')
+        return false;
+    size_t close = json.find('}', open);
+    if (close == std::string::npos)
+        return false;
+    size_t keyPos = json.find(std::string("\"") + key + "\":", open);
+    if (keyPos == std::string::npos || keyPos > close)
+        return false;
+    const char* number = json.c_str() + keyPos + strlen(key) + 3;
+    char* end = NULL;
+    value = strtod(number, &end);
+    return end != number;
+}
+
+// 0 - немає погіршень понад BENCHMARK_TOLERANCE, 1 - є, 2 - базовий файл не прочитано
+int compareBenchmarkBaseline(const std::string& json, const std::string& baselinePath) {
+    FILE* file = fopen(baselinePath.c_str(), "rb");
+    if (!file) {
+        std::cerr << "Failed to read benchmark baseline " << baselinePath << std::endl;
+        return 2;
+    }
+    std::string baseline;
+    char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        baseline.append(buffer, read);
+    fclose(file);
+
+    const char* groups[] = { "cpu_ms", "gpu_ms" };
+    const char* keys[] = { "mean", "p50", "p95", "p99", "max" };
+    int regressions = 0;
+    for (const char* group : groups) {
+        for (const char* key : keys) {
+            double current = 0.0, reference = 0.0;
+            if (!readBenchmarkValue(json, group, key, current) || !readBenchmarkValue(baseline, group, key, reference) || reference <= 0.0)
+                continue;
+            double change = current / reference - 1.0;
+            // хвости (p99, max) шумлять між запусками, тож рішення лише за p50 і p95
+            bool gated = strcmp(key, "p50") == 0 || strcmp(key, "p95") == 0;
+            bool regressed = gated && change > BENCHMARK_TOLERANCE;
+            regressions += regressed ? 1 : 0;
+            printf("%s %s: %.4f -> %.4f ms (%+.1f%%)%s\n", group, key, reference, current, change * 100.0, regressed ? " REGRESSION" : "");
+        }
+    }
+    return regressions > 0 ? 1 : 0;
+}
+
+int finishBenchmark(BenchmarkRun& run) {
+    flushGpuProfiler(gpuProfiler);
+    char header[512];
+    snprintf(header, sizeof(header), "{\n  \"frames\": %d,\n  \"warmup_frames\": %d,\n  \"timestep_ms\": %.4f,\n  \"width\": %d,\n  \"height\": %d,\n  \"renderer\": \"%s\",\n",
+        run.frames, BENCHMARK_WARMUP_FRAMES, BENCHMARK_TIMESTEP * 1000.0, framebufferWidth, framebufferHeight, (const char*)glGetString(GL_RENDERER));
+    std::string json = header;
+    json += "  \"cpu_ms\": " + frameTimeStatsJson(run.cpuFrameMs) + ",\n";
+    json += "  \"gpu_ms\": " + frameTimeStatsJson(gpuProfiler.frameMs) + "\n}\n";
+    std::cout << json;
+    if (!run.outputPath.empty()) {
+        FILE* file = fopen(run.outputPath.c_str(), "w");
+        if (file) {
+            fputs(json.c_str(), file);
+            fclose(file);
+        }
+        else
+            std::cerr << "Failed to write benchmark results " << run.outputPath << std::endl;
+    }
+    return run.baselinePath.empty() ? 0 : compareBenchmarkBaseline(json, run.baselinePath);
+}
+
+// безвіконний режим: контекст GL 3.3 core через EGL без поверхні (Mesa llvmpipe на серверах
+// без дисплея), кадр малюється у власний FBO, введення GLFW не використовується
+struct HeadlessContext {
+    bool active = false;
+    int width = 0;
+    int height = 0;
+#ifndef _WIN32
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+#endif
+    GLuint framebuffer = 0;
+    GLuint colorBuffer = 0;
+    GLuint depthBuffer = 0;
+    std::chrono::steady_clock::time_point start;
+};
+
+HeadlessContext headless;
+
+#ifndef _WIN32
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+void* headlessProcAddress(const char* name) {
+    return (void*)eglGetProcAddress(name);
+}
+
+EGLDisplay openHeadlessDisplay() {
+    // спершу платформа surfaceless з EGL_MESA_platform_surfaceless, інакше дисплей за замовчуванням
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (getPlatformDisplay && clientExtensions && strstr(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+        EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display != EGL_NO_DISPLAY)
+            return display;
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+// і для робочого контексту, і для недоробленого: після невдалого створення частини об'єктів немає,
+// а без GLAD немає й функцій GL, тож видаляються лише створені імена
+void destroyHeadlessContext(HeadlessContext& context) {
+    if (context.framebuffer)
+        glDeleteFramebuffers(1, &context.framebuffer);
+    if (context.colorBuffer)
+        glDeleteRenderbuffers(1, &context.colorBuffer);
+    if (context.depthBuffer)
+        glDeleteRenderbuffers(1, &context.depthBuffer);
+    context.framebuffer = context.colorBuffer = context.depthBuffer = 0;
+    eglMakeCurrent(context.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (context.context != EGL_NO_CONTEXT)
+        eglDestroyContext(context.display, context.context);
+    eglTerminate(context.display);
+    context.context = EGL_NO_CONTEXT;
+    context.display = EGL_NO_DISPLAY;
+    context.active = false;
+}
+
+bool createHeadlessContext(HeadlessContext& context, int width, int height) {
+    context.display = openHeadlessDisplay();
+    EGLint major = 0, minor = 0;
+    if (context.display == EGL_NO_DISPLAY || !eglInitialize(context.display, &major, &minor)) {
+        std::cerr << "Не вдалося ініціалізувати EGL" << std::endl;
+        return false;
+    }
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        std::cerr << "EGL driver has no desktop OpenGL" << std::endl;
+        eglTerminate(context.display);
+        return false;
+    }
+    // поверхня не потрібна, тож тип поверхні конфігурації не важливий
+    const EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, 0,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    if (!eglChooseConfig(context.display, configAttributes, &config, 1, &configCount) || configCount == 0 ||
+        (context.context = eglCreateContext(context.display, config, EGL_NO_CONTEXT, contextAttributes)) == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(context.display, EGL_NO_SURFACE, EGL_NO_SURFACE, context.context)) {
+        std::cerr << "Не вдалося створити безвіконний контекст OpenGL 3.3 (EGL 0x" << std::hex << eglGetError() << std::dec << ")" << std::endl;
+        if (context.context != EGL_NO_CONTEXT)
+            eglDestroyContext(context.display, context.context);
+        eglTerminate(context.display);
+        return false;
     }
-    glfwMakeContextCurrent(window);
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+    if (!gladLoadGLLoader((GLADloadproc)headlessProcAddress)) {
         std::cerr << "Не вдалося ініціалізувати GLAD" << std::endl;
-        return -1;
+        destroyHeadlessContext(context);
+        return false;
+    }
+
+    context.width = width;
+    context.height = height;
+    glGenRenderbuffers(1, &context.colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, context.colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &context.depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, context.depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glGenFramebuffers(1, &context.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, context.framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, context.colorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, context.depthBuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Headless framebuffer is incomplete" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        destroyHeadlessContext(context);
+        return false;
     }
+    glViewport(0, 0, width, height);
+    sceneFramebuffer = context.framebuffer;
+    framebufferWidth = width;
+    framebufferHeight = height;
+    context.start = std::chrono::steady_clock::now();
+    context.active = true;
+    std::cout << "Headless EGL " << major << "." << minor << ": " << glGetString(GL_RENDERER) << ", " << width << "x" << height << std::endl;
+    return true;
+}
 
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    glfwSetCursorPosCallback(window, mouse_callback);
+#else
+bool createHeadlessContext(HeadlessContext&, int, int) {
+    std::cerr << "Headless rendering needs EGL and is not available on Windows" << std::endl;
+    return false;
+}
 
-    int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-    glCompileShader(vertexShader);
+void destroyHeadlessContext(HeadlessContext&) {}
+#endif
 
-    int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-    glCompileShader(fragmentShader);
+void terminateContext() {
+    if (headless.active)
+        destroyHeadlessContext(headless);
+    else
+        glfwTerminate();
+}
 
-    int shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
+// без вікна glfwGetTime недоступний: час рахується від створення контексту
+double appTime() {
+    if (!headless.active)
+        return glfwGetTime();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - headless.start).count();
+}
 
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+// RGB кадру рядками згори вниз, як у файлах зображень (рядки GL ідуть знизу вгору)
+void readFramebufferRGB(std::vector<unsigned char>& pixels) {
+    const size_t rowBytes = (size_t)framebufferWidth * 3;
+    std::vector<unsigned char> rows(rowBytes * framebufferHeight);
+    glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, framebufferWidth, framebufferHeight, GL_RGB, GL_UNSIGNED_BYTE, rows.data());
+    pixels.resize(rows.size());
+    for (int row = 0; row < framebufferHeight; ++row)
+        memcpy(pixels.data() + row * rowBytes, rows.data() + (framebufferHeight - 1 - row) * rowBytes, rowBytes);
+}
+
+uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc = 0) {
+    static uint32_t table[256];
+    if (!table[1]) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; ++bit)
+                value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+            table[i] = value;
+        }
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+void appendU32BE(std::vector<unsigned char>& bytes, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8)
+        bytes.push_back((unsigned char)(value >> shift));
+}
+
+void appendPngChunk(std::vector<unsigned char>& png, const char* type, const std::vector<unsigned char>& data) {
+    appendU32BE(png, (uint32_t)data.size());
+    size_t typeStart = png.size();
+    png.insert(png.end(), type, type + 4);
+    png.insert(png.end(), data.begin(), data.end());
+    appendU32BE(png, crc32(png.data() + typeStart, png.size() - typeStart));
+}
+
+// PNG без стиснення (zlib stored-блоки): stb_image його читає, а кодер стиснення не потрібен
+bool writePng(const std::string& path, const unsigned char* rgb, int width, int height) {
+    std::vector<unsigned char> raw;
+    const size_t rowBytes = (size_t)width * 3;
+    raw.reserve((rowBytes + 1) * height);
+    for (int row = 0; row < height; ++row) {
+        raw.push_back(0); // фільтр None
+        raw.insert(raw.end(), rgb + row * rowBytes, rgb + (row + 1) * rowBytes);
+    }
+
+    std::vector<unsigned char> zlib = { 0x78, 0x01 };
+    for (size_t offset = 0; offset < raw.size() || offset == 0; offset += 65535) {
+        size_t blockSize = std::min(raw.size() - offset, (size_t)65535);
+        zlib.push_back(offset + blockSize >= raw.size() ? 1 : 0);
+        zlib.push_back((unsigned char)blockSize);
+        zlib.push_back((unsigned char)(blockSize >> 8));
+        zlib.push_back((unsigned char)~blockSize);
+        zlib.push_back((unsigned char)(~blockSize >> 8));
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + blockSize);
+    }
+    uint32_t a = 1, b = 0;
+    for (unsigned char byte : raw) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    appendU32BE(zlib, (b << 16) | a);
+
+    std::vector<unsigned char> header;
+    appendU32BE(header, (uint32_t)width);
+    appendU32BE(header, (uint32_t)height);
+    header.insert(header.end(), { 8, 2, 0, 0, 0 }); // 8 біт, RGB
+    std::vector<unsigned char> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    appendPngChunk(png, "IHDR", header);
+    appendPngChunk(png, "IDAT", zlib);
+    appendPngChunk(png, "IEND", std::vector<unsigned char>());
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    bool written = fwrite(png.data(), 1, png.size(), file) == png.size();
+    fclose(file);
+    return written;
+}
+
+// .png - PNG, інакше бінарний PPM (P6)
+bool saveScreenshot(const std::string& path) {
+    std::vector<unsigned char> pixels;
+    readFramebufferRGB(pixels);
+    bool written = false;
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".png") == 0)
+        written = writePng(path, pixels.data(), framebufferWidth, framebufferHeight);
+    else if (FILE* file = fopen(path.c_str(), "wb")) {
+        fprintf(file, "P6\n%d %d\n255\n", framebufferWidth, framebufferHeight);
+        written = fwrite(pixels.data(), 1, pixels.size(), file) == pixels.size();
+        fclose(file);
+    }
+    if (!written)
+        std::cerr << "Failed to write screenshot " << path << std::endl;
+    else
+        std::cout << "Screenshot written to " << path << std::endl;
+    return written;
+}
+
+// --microbench [file.json]: CPU-складові без контексту GL - сфери, ланцюжок матриць тіла,
+// декодування картинок з pictures/ і математика камери з mouse_callback
+const double MICROBENCH_MIN_SECONDS = 0.2; // мінімальна тривалість одного заміру
+const int MICROBENCH_SAMPLES = 5;          // заміри на тест; у звіт іде медіана
+
+// лічильник виділень: operator new замінений глобально, stb_image рахується через STBI_MALLOC.
+// рахується лише під --microbench: звичайний запуск не платить атомарною операцією за кожне виділення.
+// прапорець ставиться до старту пулу потоків і більше не змінюється
+std::atomic<uint64_t> allocationCount(0);
+bool countAllocations = false;
+
+inline void countAllocation() {
+    if (countAllocations)
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void* countedMalloc(size_t size) {
+    countAllocation();
+    return malloc(size);
+}
+
+void* countedRealloc(void* pointer, size_t size) {
+    countAllocation();
+    return realloc(pointer, size);
+}
+
+void* operator new(size_t size) {
+    countAllocation();
+    if (void* pointer = malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    free(pointer);
+}
+
+volatile float microbenchSink; // результати пишуться сюди, щоб компілятор не викинув роботу
+
+struct MicrobenchResult {
+    std::string name;
+    uint64_t iterations;
+    double nsPerOp;
+    double allocationsPerOp;
+    double itemsPerSecond;
+    const char* itemUnit;
+};
+
+// кількість ітерацій подвоюється, поки замір не триватиме MICROBENCH_MIN_SECONDS
+template <typename Operation>
+MicrobenchResult runMicrobench(const std::string& name, double itemsPerOp, const char* itemUnit, Operation operation) {
+    operation();
+    uint64_t iterations = 1;
+    while (true) {
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < iterations; ++i)
+            operation();
+        if (std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() >= MICROBENCH_MIN_SECONDS || iterations >= (1ull << 40))
+            break;
+        iterations *= 2;
+    }
+    std::vector<double> nsPerOp;
+    uint64_t allocations = 0;
+    for (int sample = 0; sample < MICROBENCH_SAMPLES; ++sample) {
+        uint64_t allocationsBefore = allocationCount.load(std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < iterations; ++i)
+            operation();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        allocations += allocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+        nsPerOp.push_back(ns / iterations);
+    }
+    std::sort(nsPerOp.begin(), nsPerOp.end());
+    MicrobenchResult result;
+    result.name = name;
+    result.iterations = iterations;
+    result.nsPerOp = nsPerOp[MICROBENCH_SAMPLES / 2];
+    result.allocationsPerOp = (double)allocations / (iterations * MICROBENCH_SAMPLES);
+    result.itemsPerSecond = itemsPerOp * 1.0e9 / result.nsPerOp;
+    result.itemUnit = itemUnit;
+    std::cerr << name << ": " << result.nsPerOp << " ns/op, " << result.allocationsPerOp << " allocs/op" << std::endl;
+    return result;
+}
+
+std::vector<std::string> listDirectory(const std::string& directory) {
+    std::vector<std::string> names;
+#ifdef _WIN32
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA((directory + "/*").c_str(), &entry);
+    if (find == INVALID_HANDLE_VALUE)
+        return names;
+    do {
+        if (!(entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            names.push_back(entry.cFileName);
+    } while (FindNextFileA(find, &entry));
+    FindClose(find);
+#else
+    DIR* dir = opendir(directory.c_str());
+    if (!dir)
+        return names;
+    while (dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] != '.')
+            names.push_back(entry->d_name);
+    }
+    closedir(dir);
+#endif
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+int runMicrobenchmarks(const std::string& outputPath) {
+    countAllocations = true;
+    std::vector<MicrobenchResult> results;
+
+    for (int level = 0; level < SPHERE_LOD_COUNT; ++level) {
+        const SphereLodLevel& lod = sphereLodLevels[level];
+        char name[64];
+        snprintf(name, sizeof(name), "generateSphere/%ux%u", lod.sectorCount, lod.stackCount);
+        double vertices = (double)(lod.sectorCount + 1) * (lod.stackCount + 1);
+        results.push_back(runMicrobench(name, vertices, "vertices/s", [&lod]() {
+            std::vector<float> vertices;
+            std::vector<unsigned int> indices;
+            generateSphere(vertices, indices, 1.0f, lod.sectorCount, lod.stackCount, true);
+            microbenchSink = vertices.back();
+        }));
+    }
+
+    // той самий ланцюжок, що в drawCelestialBody: орбіта, зсув, нахил осі, власне обертання, масштаб
+    CelestialBody moonLike;
+    moonLike.orbitRadius = 0.3f;
+    moonLike.orbitSpeed = 13.0f;
+    moonLike.rotationSpeed = 0.0f;
+    moonLike.size = 0.027f;
+    moonLike.rotationDirection = 1.0f;
+    moonLike.axisTilt = 6.68f;
+    const float savedDay = day;
+    glm::mat4 parentModel = glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+    results.push_back(runMicrobench("bodyMatrixChain", 1.0, "bodies/s", [&moonLike, &parentModel]() {
+        day += 0.001f;
+        glm::mat4 model = computeBodyModel(moonLike, parentModel);
+        glm::mat3 normalMatrix = computeNormalMatrix(model);
+        microbenchSink = model[3][0] + normalMatrix[0][0];
+    }));
+    day = savedDay;
+
+    const float savedYaw = yaw, savedPitch = pitch, savedLastX = lastX, savedLastY = lastY;
+    const bool savedFirstMouse = firstMouse;
+    const glm::vec3 savedFront = cameraFront;
+    double mouseX = 0.0;
+    results.push_back(runMicrobench("mouseCallback", 1.0, "events/s", [&mouseX]() {
+        mouseX += 1.0;
+        mouse_callback(NULL, mouseX, fmod(mouseX, 200.0));
+        microbenchSink = cameraFront.x;
+    }));
+    yaw = savedYaw;
+    pitch = savedPitch;
+    lastX = savedLastX;
+    lastY = savedLastY;
+    firstMouse = savedFirstMouse;
+    cameraFront = savedFront;
+
+    // лише стадія декодування loadTexture: без .ktx2, архіву й кешу (mipChain вимкнено)
+    for (const std::string& file : listDirectory("pictures")) {
+        std::string extension = file.substr(file.find_last_of('.') + 1);
+        if (extension != "jpg" && extension != "jpeg" && extension != "png")
+            continue;
+        DecodedImage probe;
+        probe.path = "pictures/" + file;
+        decodeImage(probe);
+        if (probe.pixels.empty())
+            continue;
+        double megapixels = (double)probe.width * probe.height / 1.0e6;
+        results.push_back(runMicrobench("decodeImage/" + file, megapixels, "megapixels/s", [&file]() {
+            DecodedImage image;
+            image.path = "pictures/" + file;
+            decodeImage(image);
+            microbenchSink = image.pixels.empty() ? 0.0f : image.pixels[0];
+        }));
+    }
+
+    std::string json = "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const MicrobenchResult& result = results[i];
+        char line[512];
+        snprintf(line, sizeof(line), "    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.2f, \"allocs_per_op\": %.3f, \"throughput\": %.2f, \"throughput_unit\": \"%s\"}%s\n",
+            result.name.c_str(), (unsigned long long)result.iterations, result.nsPerOp, result.allocationsPerOp, result.itemsPerSecond, result.itemUnit,
+            i + 1 < results.size() ? "," : "");
+        json += line;
+    }
+    json += "  ]\n}\n";
+    std::cout << json;
+    if (!outputPath.empty()) {
+        FILE* file = fopen(outputPath.c_str(), "w");
+        if (!file) {
+            std::cerr << "Failed to write " << outputPath << std::endl;
+            return 1;
+        }
+        fputs(json.c_str(), file);
+        fclose(file);
+    }
+    return 0;
+}
+
+// --golden <dir>: фіксовані (день, камера) кадри порівнюються з еталонними PNG у dir;
+// --golden-update перезаписує еталони. Еталони в tests/golden зняті під llvmpipe (Mesa, EGL):
+//     solar --headless 256x256 --golden tests/golden [--golden-update]
+// текстури читаються за texturePath тіл, тож pictures/ мусить бути доступна за тим шляхом
+// (на Linux "D:/vscode_asd_laz/test_shaders/pictures" - відносний шлях від робочої теки).
+// порівняння терпить лише дрібні відмінності растеризації
+const int GOLDEN_SETTLE_FRAMES = 8;            // кадрів на віртуальні текстури: зворотний зв'язок -> тайли -> таблиця
+const int GOLDEN_PIXEL_TOLERANCE = 12;         // різниця яскравості 0..255, яку не видно оку
+const double GOLDEN_MAX_DIFF_FRACTION = 0.001; // частка пікселів понад допуск, після якої тест падає
+
+struct GoldenCase {
+    const char* name;
+    float day;
+    bool impostors;
+    CameraKey camera; // time не використовується
+};
+
+const GoldenCase goldenCases[] = {
+    { "overview",        0.0f, false, { 0.0f, NULL,          glm::vec3(0.0f, 1.0f, 10.0f),  glm::vec3(0.0f) } },
+    { "top_down",       90.0f, false, { 0.0f, NULL,          glm::vec3(0.0f, 14.0f, 14.0f), glm::vec3(0.0f) } },
+    { "inner_orbits",   30.0f, false, { 0.0f, NULL,          glm::vec3(2.5f, 0.6f, 2.0f),   glm::vec3(0.0f) } },
+    { "jupiter_close",  45.0f, false, { 0.0f, "jupiter.jpg", glm::vec3(0.0f, 0.3f, 1.4f),   glm::vec3(0.0f) } },
+    { "impostors",       0.0f, true,  { 0.0f, NULL,          glm::vec3(0.0f, 1.0f, 10.0f),  glm::vec3(0.0f) } },
+};
+
+// різниця в зваженій яскравості (Rec. 601) з окремою перевіркою кольору: зсув відтінку при
+// тій самій яскравості теж має бути помітним
+int goldenPixelDifference(const unsigned char* a, const unsigned char* b) {
+    int dr = abs(a[0] - b[0]), dg = abs(a[1] - b[1]), db = abs(a[2] - b[2]);
+    int luma = abs(299 * (a[0] - b[0]) + 587 * (a[1] - b[1]) + 114 * (a[2] - b[2])) / 1000;
+    return std::max(luma, std::max(dr, std::max(dg, db)) / 2);
+}
+
+int runGoldenTests(const SceneProgram* scenePrograms, CelestialBody& sun, const CelestialBody& earth, CelestialBody& moon, const std::string& directory, bool update) {
+    makeDirectory(directory.c_str());
+    int failed = 0;
+    for (const GoldenCase& test : goldenCases) {
+        day = test.day;
+        impostorMode = test.impostors;
+        resolveCameraKey(test.camera, cameraPos, cameraFront);
+        cameraFront = glm::normalize(cameraFront - cameraPos);
+        for (int frame = 0; frame < GOLDEN_SETTLE_FRAMES; ++frame) {
+            updateVirtualTextures(virtualTextures);
+            renderScene(scenePrograms, sun, earth, moon);
+            glFinish();
+        }
+        std::vector<unsigned char> actual;
+        readFramebufferRGB(actual);
+
+        const std::string referencePath = directory + "/" + test.name + ".png";
+        if (update) {
+            bool written = writePng(referencePath, actual.data(), framebufferWidth, framebufferHeight);
+            std::cout << (written ? "updated " : "FAILED to write ") << referencePath << std::endl;
+            failed += written ? 0 : 1;
+            continue;
+        }
+
+        int width = 0, height = 0, channels = 0;
+        stbi_set_flip_vertically_on_load_thread(0);
+        unsigned char* reference = stbi_load(referencePath.c_str(), &width, &height, &channels, 3);
+        size_t differing = 0;
+        std::vector<unsigned char> diff(actual.size());
+        if (reference && width == framebufferWidth && height == framebufferHeight) {
+            // diff: відмінні пікселі червоні поверх приглушеного еталону
+            for (size_t pixel = 0; pixel < actual.size() / 3; ++pixel) {
+                const unsigned char* a = actual.data() + pixel * 3;
+                const unsigned char* r = reference + pixel * 3;
+                bool differs = goldenPixelDifference(a, r) > GOLDEN_PIXEL_TOLERANCE;
+                differing += differs ? 1 : 0;
+                unsigned char grey = (unsigned char)((r[0] + r[1] + r[2]) / 9);
+                diff[pixel * 3 + 0] = differs ? 255 : grey;
+                diff[pixel * 3 + 1] = differs ? 0 : grey;
+                diff[pixel * 3 + 2] = differs ? 0 : grey;
+            }
+        }
+        else
+            differing = actual.size() / 3;
+        double fraction = (double)differing / (actual.size() / 3);
+        bool passed = reference && fraction <= GOLDEN_MAX_DIFF_FRACTION;
+        if (!reference)
+            printf("FAIL %s: no reference %s (run with --golden-update)\n", test.name, referencePath.c_str());
+        else if (width != framebufferWidth || height != framebufferHeight)
+            printf("FAIL %s: reference is %dx%d, frame is %dx%d\n", test.name, width, height, framebufferWidth, framebufferHeight);
+        else
+            printf("%s %s: %.4f%% pixels differ\n", passed ? "ok  " : "FAIL", test.name, fraction * 100.0);
+        if (!passed) {
+            ++failed;
+            writePng(directory + "/" + test.name + ".actual.png", actual.data(), framebufferWidth, framebufferHeight);
+            if (reference && width == framebufferWidth && height == framebufferHeight)
+                writePng(directory + "/" + test.name + ".diff.png", diff.data(), framebufferWidth, framebufferHeight);
+        }
+        stbi_image_free(reference);
+    }
+    printf("%d/%d golden images %s\n", (int)(sizeof(goldenCases) / sizeof(goldenCases[0])) - failed,
+        (int)(sizeof(goldenCases) / sizeof(goldenCases[0])), update ? "written" : "match");
+    return failed;
+}
+
+int main(int argc, char** argv){
+    int compareFrames = 0;
+    int bakeCodec = -1;
+    bool packMode = false;
+    bool gpuProfile = false;
+    std::string tracePath;
+    bool headlessMode = false;
+    int headlessWidth = SCR_WIDTH, headlessHeight = SCR_HEIGHT;
+    int headlessFrames = 1;
+    std::string screenshotPath;
+    std::string goldenDirectory;
+    bool goldenUpdate = false;
+    bool microbench = false;
+    int asteroidCount = 0;
+    int nbodyParticles = -1;
+    int nbodyKernel = -1;
+    int nbodyBenchCount = 0;
+    std::string microbenchOutput;
+    std::string tileSource, tileTarget;
+    size_t uploadBudget = DEFAULT_UPLOAD_BUDGET;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--impostors") == 0)
+            impostorMode = true;
+        else if (strcmp(argv[i], "--compare-impostors") == 0)
+            compareFrames = (i + 1 < argc) ? atoi(argv[++i]) : 200;
+        else if (strcmp(argv[i], "--pack") == 0)
+            packMode = true;
+        else if (strcmp(argv[i], "--gpu-profile") == 0)
+            gpuProfile = true;
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            tracePath = argv[++i];
+        else if (strcmp(argv[i], "--headless") == 0) {
+            // --headless [ШxВ]
+            headlessMode = true;
+            if (i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &headlessWidth, &headlessHeight) == 2) {
+                ++i;
+                headlessWidth = std::max(headlessWidth, 1);
+                headlessHeight = std::max(headlessHeight, 1);
+            }
+        }
+        else if (strcmp(argv[i], "--benchmark") == 0) {
+            benchmark.frames = BENCHMARK_DEFAULT_FRAMES;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                benchmark.frames = std::max(atoi(argv[++i]), 1);
+        }
+        else if (strcmp(argv[i], "--benchmark-output") == 0 && i + 1 < argc)
+            benchmark.outputPath = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+            benchmark.baselinePath = argv[++i];
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            headlessFrames = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--screenshot") == 0 && i + 1 < argc)
+            screenshotPath = argv[++i];
+        else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc)
+            goldenDirectory = argv[++i];
+        else if (strcmp(argv[i], "--golden-update") == 0)
+            goldenUpdate = true;
+        else if (strcmp(argv[i], "--asteroids") == 0) {
+            asteroidCount = ASTEROID_DEFAULT_COUNT;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                asteroidCount = std::max(atoi(argv[++i]), 0);
+        }
+        else if (strcmp(argv[i], "--nbody") == 0) {
+            nbodyParticles = 0;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                nbodyParticles = std::max(atoi(argv[++i]), 0);
+        }
+        else if (strcmp(argv[i], "--nbody-kernel") == 0 && i + 1 < argc) {
+            ++i;
+            for (int kernel = 0; kernel < NBODY_KERNEL_COUNT; ++kernel) {
+                if (strcmp(argv[i], nbodyKernelNames[kernel]) == 0)
+                    nbodyKernel = kernel;
+            }
+            if (nbodyKernel < 0 || !nbodyKernelAvailable(nbodyKernel)) {
+                std::cerr << "N-body kernel not supported by this CPU: " << argv[i] << std::endl;
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--nbody-bench") == 0) {
+            nbodyBenchCount = NBODY_BENCH_DEFAULT_COUNT;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                nbodyBenchCount = std::max(atoi(argv[++i]), 2);
+        }
+        else if (strcmp(argv[i], "--microbench") == 0) {
+            microbench = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                microbenchOutput = argv[++i];
+        }
+        else if (strcmp(argv[i], "--tile") == 0 && i + 1 < argc) {
+            // --tile <карта 16k-32k> [текстура тіла, поруч з якою покласти .vt]
+            tileSource = argv[++i];
+            tileTarget = (i + 1 < argc && argv[i + 1][0] != '-') ? argv[++i] : tileSource;
+        }
+        else if (strcmp(argv[i], "--upload-budget") == 0 && i + 1 < argc)
+            uploadBudget = (size_t)std::max(atoi(argv[++i]), 1) * 1024; // КБ на кадр
+        else if (strcmp(argv[i], "--bake") == 0) {
+            bakeCodec = TEXTURE_CODEC_BC7;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                ++i;
+                bakeCodec = -1;
+                for (int codec = 0; codec < TEXTURE_CODEC_COUNT; ++codec) {
+                    if (strcmp(argv[i], textureCodecs[codec].name) == 0)
+                        bakeCodec = codec;
+                }
+                if (bakeCodec < 0) {
+                    std::cerr << "Unknown texture format: " << argv[i] << " (bc1, bc7, etc2)" << std::endl;
+                    return -1;
+                }
+            }
+        }
+    }
+
+    if (goldenUpdate && goldenDirectory.empty()) {
+        std::cerr << "--golden-update needs --golden <dir>" << std::endl;
+        return -1;
+    }
+    sourceAssetsOnly = !goldenDirectory.empty();
+    if (!tileSource.empty())
+        return tileVirtualTexture(tileSource, tileTarget);
+    if (microbench)
+        return runMicrobenchmarks(microbenchOutput);
+    if (nbodyBenchCount > 0)
+        return runNBodyBenchmark(nbodyBenchCount);
+    // без --nbody-kernel - найширше ядро, яке підтримує процесор
+    if (nbodyKernel < 0) {
+        for (int kernel = 0; kernel < NBODY_KERNEL_COUNT; ++kernel)
+            nbodyKernel = nbodyKernelAvailable(kernel) ? kernel : nbodyKernel;
+    }
+
+    if (!tracePath.empty())
+        startCpuProfiler(tracePath);
+    startThreadPool(workerPool, std::max(std::thread::hardware_concurrency(), 1u));
+
+    // тіла й шляхи їхніх текстур не потребують GL, тож офлайнові --bake і --pack ідуть до створення контексту
     initСelestialBodies();
     CelestialBody moon;
     moon.size = 0.027f;
@@ -590,7 +5596,8 @@ int main(){
     moon.material.specular = glm::vec3(0.1f, 0.1f, 0.1f);
     moon.material.shininess = 8.0f;
     moon.material.emission = glm::vec3(0.0f);
-    moon.textureID = loadTexture("D:/vscode_asd_laz/test_shaders/pictures/moon.jpg");
+    moon.texturePath = "D:/vscode_asd_laz/test_shaders/pictures/moon.jpg";
+    moon.textureLayer = addTextureArrayLayer(bodyTextures, moon.texturePath);
 
     CelestialBody earth;
     earth.orbitRadius = 1.0f;
@@ -603,9 +5610,9 @@ int main(){
     earth.material.specular = glm::vec3(0.5f, 0.5f, 0.5f);
     earth.material.shininess = 32.0f;
     earth.material.emission = glm::vec3(0.0f); 
+    earth.mass = 3.0e-6f;
     earth.texturePath = "D:/vscode_asd_laz/test_shaders/pictures/terra.jpg";
-    earth.textureID = loadTexture(earth.texturePath);
-    celestialBodies.push_back(earth);
+    earth.textureLayer = addTextureArrayLayer(bodyTextures, earth.texturePath);
 
     CelestialBody sun;
     sun.size = 0.15f;
@@ -618,46 +5625,192 @@ int main(){
     sun.material.specular = glm::vec3(1.0f, 1.0f, 1.0f);
     sun.material.shininess = 20.0f;
     sun.material.emission = glm::vec3(1.0f);
-    sun.textureID = loadTexture("D:/vscode_asd_laz/test_shaders/pictures/sun.jpg");
+    sun.mass = 1.0f;
+    sun.texturePath = "D:/vscode_asd_laz/test_shaders/pictures/sun.jpg";
+    sun.textureLayer = addTextureArrayLayer(bodyTextures, sun.texturePath);
+
+    // Місяць лишається на коловій орбіті навколо (вже симульованої) Землі: на кроці 0.1 дня
+    // його двотижневий оберт розвалився б
+    if (nbodyParticles >= 0) {
+        for (auto& celestialBody : celestialBodies) {
+            if (celestialBody.mass > 0.0f)
+                registerNBody(nbody, celestialBody);
+        }
+        registerNBody(nbody, earth);
+        registerNBody(nbody, sun);
+    }
+    celestialBodies.push_back(earth);
+
+    if (bakeCodec >= 0) {
+        int failed = bakeTextures(bodyTextures, bakeCodec);
+        stopThreadPool(workerPool);
+        return failed == 0 ? 0 : 1;
+    }
+    if (packMode) {
+        int failed = writeAssetPack(bodyTextures, ASSET_PACK_PATH);
+        stopThreadPool(workerPool);
+        return failed == 0 ? 0 : 1;
+    }
+
+    GLFWwindow* window = NULL;
+    GLADloadproc loadProc = (GLADloadproc)glfwGetProcAddress;
+    if (headlessMode) {
+#ifndef _WIN32
+        loadProc = (GLADloadproc)headlessProcAddress;
+#endif
+        if (!createHeadlessContext(headless, headlessWidth, headlessHeight))
+            return -1;
+    }
+    else {
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Solar System", NULL, NULL);
+        if (window == NULL) {
+            std::cerr << "Не вдалося створити вікно GLFW" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+        glfwMakeContextCurrent(window);
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+            std::cerr << "Не вдалося ініціалізувати GLAD" << std::endl;
+            return -1;
+        }
+
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+        glfwSetCursorPosCallback(window, mouse_callback);
+    }
+
+    loadGLExtensions(loadProc);
+    if (gpuProfile || benchmark.frames > 0)
+        startGpuProfiler(gpuProfiler);
+    if (benchmark.frames > 0) {
+        gpuProfiler.report = gpuProfile;
+        gpuProfiler.recordFrom = BENCHMARK_WARMUP_FRAMES;
+        // vsync прив'язав би час кадру до частоти монітора
+        if (window)
+            glfwSwapInterval(0);
+    }
+    if (!sourceAssetsOnly && openAssetPack(assetPack, ASSET_PACK_PATH))
+        usePackedShaderSources();
+
+    auto shaderStart = std::chrono::steady_clock::now();
+    int cachedPrograms = 0;
+    SceneProgram scenePrograms[PERMUTATION_COUNT];
+    for (int permutation = 0; permutation < PERMUTATION_COUNT; ++permutation) {
+        bool fromCache = false;
+        GLuint program = buildShaderProgramCached(vertexShaderSource, fragmentShaderSource, permutationDefines[permutation], &fromCache);
+        cachedPrograms += fromCache ? 1 : 0;
+        scenePrograms[permutation] = createSceneProgram(program, permutation);
+    }
+    double shaderMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - shaderStart).count();
+    std::cout << "Shader programs ready in " << shaderMs << " ms (" << cachedPrograms << "/" << PERMUTATION_COUNT << " from cache)" << std::endl;
+    createFrameUniformBuffers();
+    if (asteroidCount > 0)
+        createAsteroidField(asteroidField, asteroidCount);
+
+    startTextureStreaming(textureStreamer, bodyTextures, skyTextureID, uploadBudget);
+    for (auto& celestialBody : celestialBodies)
+        celestialBody.virtualTexture = loadVirtualTexture(virtualTextures, replaceExtension(celestialBody.texturePath, ".vt"));
+    moon.virtualTexture = loadVirtualTexture(virtualTextures, replaceExtension(moon.texturePath, ".vt"));
+    sun.virtualTexture = loadVirtualTexture(virtualTextures, replaceExtension(sun.texturePath, ".vt"));
+    if (nbodyParticles >= 0) {
+        // частинки диска малюються як дрібні місяці тим самим інстансингом, що й планети
+        int firstParticle = nbody.count;
+        addNBodyParticles(nbody, nbodyParticles, NBODY_SEED);
+        for (int index = firstParticle; index < nbody.count; ++index) {
+            CelestialBody particle = moon;
+            particle.size = 0.004f;
+            particle.mass = 1e-10f;
+            particle.simulationIndex = index;
+            celestialBodies.push_back(particle);
+        }
+        startNBody(nbody, nbodyKernel);
+        std::cout << "N-body: " << nbody.count << " bodies, " << nbodyKernelNames[nbody.kernel] << " kernel" << std::endl;
+    }
 
     glEnable(GL_DEPTH_TEST);
    
-    glm::mat4 sunModel = glm::mat4(1.0f);
+    float lastTitleUpdate = 0.0f;
 
-    while (!glfwWindowShouldClose(window)) {
+    if (compareFrames > 0) {
+        finishTextureStreaming(textureStreamer);
+        compareBodyRenderers(scenePrograms, sun, earth, moon, compareFrames);
+        terminateContext();
+        return 0;
+    }
+    if (!goldenDirectory.empty()) {
+        finishTextureStreaming(textureStreamer);
+        int failed = runGoldenTests(scenePrograms, sun, earth, moon, goldenDirectory, goldenUpdate);
+        stopThreadPool(workerPool);
+        terminateContext();
+        return failed == 0 ? 0 : 1;
+    }
 
-        glm::mat4 earthModel = glm::mat4(1.0f);
-        float earthOrbitAngle = glm::radians(day * earth.orbitSpeed);
-        earthModel = glm::rotate(earthModel, earthOrbitAngle, glm::vec3(0.0f, 1.0f, 0.0f));
-        earthModel = glm::translate(earthModel, glm::vec3(earth.orbitRadius, 0.0f, 0.0f));
-        earthModel = glm::rotate(earthModel, glm::radians(earth.axisTilt), glm::vec3(1.0f, 0.0f, 0.0f));
-        float earthSelfRotationAngle = glm::radians(day * earth.rotationSpeed * earth.rotationDirection);
-        earthModel = glm::rotate(earthModel, earthSelfRotationAngle, glm::vec3(0.0f, 1.0f, 0.0f));
-        float currentFrame = glfwGetTime();
+    // без вікна і в бенчмарку кадри малюються з повними текстурами, а не з сірими заглушками
+    // потокового завантаження
+    if (headless.active || benchmark.frames > 0)
+        finishTextureStreaming(textureStreamer);
+    const int frameLimit = benchmark.frames > 0 ? benchmark.frames : headlessFrames;
+    int renderedFrames = 0;
+    if (benchmark.frames > 0)
+        benchmark.frameStart = std::chrono::steady_clock::now();
+    while ((headless.active || benchmark.frames > 0) ? renderedFrames < frameLimit : !glfwWindowShouldClose(window)) {
+        CPU_ZONE("frame");
+        float currentFrame = (float)appTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
-        processInput(window);
-
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-        glm::mat4 projection = glm::perspective(glm::radians(fov), (float)SCR_WIDTH / SCR_HEIGHT, 0.1f, 100.0f);
+        if (benchmark.frames > 0) {
+            if (renderedFrames > 0)
+                markBenchmarkFrame(benchmark, renderedFrames);
+            deltaTime = BENCHMARK_TIMESTEP;
+            applyBenchmarkCamera(renderedFrames * BENCHMARK_TIMESTEP);
+        }
+        else if (window)
+            processInput(window);
 
-        drawSkySphere(shaderProgram, view, projection);
-        drawCelestialBody(shaderProgram, view, projection, cameraPos, sun);
-        for (const auto& celestialBody : celestialBodies) {
-            drawCelestialBody(shaderProgram, view, projection, cameraPos, celestialBody, sunModel);
+        beginGpuFrame(gpuProfiler);
+        {
+            GpuProfileScope profileScope("texture uploads");
+            pumpTextureStreaming(textureStreamer);
+            updateVirtualTextures(virtualTextures);
         }
-        drawCelestialBody(shaderProgram, view, projection, cameraPos, moon, earthModel);
+        updateNBody(nbody, day);
+        renderScene(scenePrograms, sun, earth, moon);
+        endGpuFrame(gpuProfiler);
         day += 10.0f * deltaTime;
+        ++renderedFrames;
+        if (!window)
+            continue;
+
+        if (currentFrame - lastTitleUpdate > 0.5f) {
+            char title[128];
+            snprintf(title, sizeof(title), "Solar System | %s | visible %d, culled %d", impostorMode ? "impostors" : "meshes", cullStats.visible, cullStats.culled);
+            glfwSetWindowTitle(window, title);
+            lastTitleUpdate = currentFrame;
+        }
 
-        glfwSwapBuffers(window);
+        {
+            CPU_ZONE("glfwSwapBuffers");
+            glfwSwapBuffers(window);
+        }
         glfwPollEvents();
     }
-    glDeleteProgram(shaderProgram);
-    glfwTerminate();
-    return 0;
+    int exitCode = 0;
+    if (benchmark.frames > 0) {
+        markBenchmarkFrame(benchmark, renderedFrames);
+        exitCode = finishBenchmark(benchmark);
+    }
+    if (!screenshotPath.empty())
+        saveScreenshot(screenshotPath);
+    for (int permutation = 0; permutation < PERMUTATION_COUNT; ++permutation)
+        glDeleteProgram(scenePrograms[permutation].program.id);
+    // воркери можуть ще декодувати в textureStreamer, який знищиться раніше за пул
+    stopThreadPool(workerPool);
+    writeCpuTrace();
+    terminateContext();
+    return exitCode;
 }
 
 